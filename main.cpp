@@ -5,122 +5,384 @@
 #include <cmath>
 #include <algorithm>
 #include <ranges>
+#include <memory>
+#include <cstring>
+#include <bit>
+#include <vector>
+#include <utility>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <span>
+#include <limits>
+#include <type_traits>
+#include <numbers>
+#include <array>
+#include <complex>
 
 
+struct executable_formula;
+template<class T>
+struct dual;
+template<class T>
+using hyper_dual = dual<dual<T>>;
+template<class T>
+hyper_dual<T> make_hyper_dual(T x);
+template<class T, size_t N>
+struct taylor;
+
+//How closely the built-in functions track libm in batch evaluation. Single
+//calls are always exact: one lane of the vector kernels is slower than libm.
+enum class accuracy
+{
+	exact, //libm itself, the same results as every other tier
+	faithful, //within a few ulp of libm
+	fast, //relative error below 1e-7
+};
+
 class formula
 {
 	std::string m_expr;
+	std::unique_ptr<executable_formula> m_executable;
+	size_t m_compile_threshold;
+	std::string m_parse_error;
+	size_t m_parse_stop = 0;
+	size_t m_eliminated_nodes = 0;
 
 public:
-	formula(const std::string& expression);
+	static constexpr size_t default_compile_threshold = 1000;
+
+	formula(const std::string& expression, size_t compile_threshold = default_compile_threshold);
+	formula(formula&&) noexcept;
+	formula& operator=(formula&&) noexcept;
+	~formula();
+
 	bool validate(std::string& err_msg, const char*& err_pos) const noexcept;
 	double operator()(double argument) const;
+	void evaluate(std::span<const double> arguments, std::span<double> results, accuracy policy = accuracy::faithful) const;
+	//Single precision throughout, at accuracy::fast, for coarse scans
+	void evaluate(std::span<const float> arguments, std::span<float> results) const;
+	//Any scalar type T: double takes the path above, other types run the
+	//tree and, once hot, the compiled program in T with their own math functions
+	template<class T>
+	T eval(T argument) const;
+	//Builds the formula with the system C++ compiler and routes operator() to
+	//the result. Slow the first time; false if no compiler or not on POSIX.
+	bool compile_ahead_of_time() const;
+	//The symbolic derivative, simplified and compiled like any other formula;
+	//invalid if this one is
+	formula derivative(size_t compile_threshold = default_compile_threshold) const;
+	//The expression without blanks, as parsed
+	const std::string& text() const noexcept;
+
+	size_t eliminated_nodes() const noexcept;
 };
 using func = const formula&;
 
+void run_benchmarks();
+int run_math_check();
 
-const double h = 0.01;
-double sign(double x)
+
+//The solvers take any formula type F with an eval member, formula or
+//static_formula, and work in any scalar type T that it supports. Math
+//functions are called unqualified so that custom types are found by ADL.
+template<class T>
+T sign(T x)
 {
+	using std::copysign;
 	if (x != x)
 		return x;
-	return std::copysign(1, x) * (x != 0);
+	return copysign(T(1), x) * T(x != 0);
 }
-void report_approximation(size_t step, double x, double y)
+template<class T>
+void report_approximation(size_t step, T x, T y)
 {
+	//Benchmarks silence the solvers; skip the formatting too
+	if (!std::cout)
+		return;
 	std::cout << std::format("x{:02} = {:<+22.16g} y{:02} = {:<+22.16g}\n", step, x, step, y);
 }
-double get_second_difference(func f, double x)
+template<class T>
+bool sign_matches(T a, T b)
+{
+	using std::copysign;
+	return copysign(a, b) == a;
+}
+//f'(x) from Im f(x + ih) / h. Unlike a central difference nothing cancels, so
+//h can be far below the rounding of x and the result is good to a few ulp
+template<class F, class T>
+T complex_step_derivative(const F& f, T x)
 {
-	return f(x + h) - 2 * f(x) + f(x - h);
+	using std::abs;
+	const T step = T(1e-20) * std::max(T(1), abs(x));
+	return f.eval(std::complex<T>(x, step)).imag() / step;
 }
-bool sign_matches(double a, double b)
+template<class T>
+bool isinfnan(T x)
+{
+	using std::isnan, std::isinf;
+	return isnan(x) || isinf(x);
+}
+
+//Numeric derivatives, for formula types without dual support. A central
+//difference loses noise / h^order to rounding and gains a multiple of h^2 in
+//truncation, so the step is balanced per x against the noise of f relative
+//to its magnitude. With Richardson extrapolation D(h) and D(h/2) cancel the
+//h^2 term, allowing a larger h; h is then halved while successive
+//extrapolations keep getting closer, which also catches f varying on a much
+//shorter scale than x.
+template<class T>
+struct difference_estimate
+{
+	T value = T(NAN);
+	//Estimated absolute error; without Richardson only the rounding part
+	T error = T(NAN);
+	size_t evaluations = 0;
+};
+template<class T>
+struct function_noise
 {
-	return std::copysign(a, b) == a;
+	T noise = T(NAN);
+	//The length over which f looks smooth, at most max(|x|, 1)
+	T scale = T(NAN);
+	//max(|f|, |f'| * scale), the size that the noise is relative to
+	T magnitude = T(NAN);
+};
+
+//Moré and Wild's ECnoise: on a grid fine enough for the smooth part of f to
+//vanish below its noise, k-th differences scaled by (k!)^2 / (2k)! have the
+//noise variance as their mean square. An order is accepted when its
+//differences change sign and the next order agrees within a factor of 4;
+//noise is never taken below the rounding of the magnitude.
+template<class F, class T>
+function_noise<T> estimate_noise(const F& f, T x, T scale, size_t& evaluations)
+{
+	using std::abs, std::sqrt;
+	constexpr int points = 8;
+	const T delta = T(1e-5) * scale;
+
+	T y[points];
+	for (int i = 0; i < points; ++i)
+		y[i] = f.eval(x + T(double(i - points / 2)) * delta);
+	evaluations += points;
+
+	function_noise<T> result;
+	result.scale = scale;
+	result.magnitude = std::max(abs(y[points / 2]), abs(y[points - 1] - y[0]) / T(double(points - 1)) / delta * scale);
+
+	T sigma[points] = {};
+	bool sign_change[points] = {};
+	T gamma = 1;
+	for (int k = 1; k < points; ++k)
+	{
+		gamma *= T(double(k * k)) / T(double(2 * k * (2 * k - 1)));
+		T sum = 0;
+		bool positive = false, negative = false;
+		for (int i = 0; i < points - k; ++i)
+		{
+			y[i] = y[i + 1] - y[i];
+			sum += y[i] * y[i];
+			positive |= y[i] > 0;
+			negative |= y[i] < 0;
+		}
+		sigma[k] = sqrt(gamma * sum / T(double(points - k)));
+		sign_change[k] = positive && negative;
+	}
+
+	T noise = 0;
+	for (int k = 1; k + 1 < points; ++k)
+	{
+		if (sign_change[k] && sigma[k] <= 4 * sigma[k + 1] && sigma[k + 1] <= 4 * sigma[k])
+		{
+			noise = sigma[k];
+			break;
+		}
+	}
+	result.noise = std::max(noise, std::numeric_limits<T>::epsilon() * result.magnitude);
+	return result;
 }
-double finite_difference_derivative(func f, double x)
+//A formula is only noisy through rounding, so noise far above it means that
+//the grid is too coarse for f: narrow it while it stays above the ulp of x.
+//Rounding through a long formula stays well below eps^(2/3) of its magnitude.
+template<class F, class T>
+function_noise<T> estimate_noise(const F& f, T x, size_t& evaluations)
 {
-	return (f(x + h) - f(x - h)) / (2 * h);
+	using std::abs, std::pow;
+	constexpr int max_narrowings = 2;
+	const T threshold = pow(std::numeric_limits<T>::epsilon(), T(2) / T(3));
+	function_noise<T> result = estimate_noise(f, x, std::max(T(1), abs(x)), evaluations);
+	for (int k = 0; k < max_narrowings && !(result.noise <= threshold * result.magnitude); ++k)
+		result = estimate_noise(f, x, result.scale / 1000, evaluations);
+	return result;
 }
-double finite_difference_second_derivative(func f, double x)
+
+//The first or second derivative of f at x
+template<class F, class T>
+difference_estimate<T> estimate_derivative(const F& f, T x, int order, bool richardson = true)
 {
-	return get_second_difference(f, x) / (2 * h);
+	using std::abs, std::pow;
+	difference_estimate<T> result;
+	if (order != 1 && order != 2)
+		return result;
+
+	const function_noise<T> noise = estimate_noise(f, x, result.evaluations);
+	const T relative_noise = std::clamp(noise.noise / noise.magnitude, std::numeric_limits<T>::epsilon(), T(1));
+	const T step = noise.scale * pow(relative_noise, T(1) / T(double(order + (richardson ? 4 : 2))));
+
+	const T y = order == 2 ? f.eval(x) : T(0);
+	result.evaluations += order == 2;
+	auto central = [&](T h, T& rounding)
+	{
+		//x + h and x - h must be exactly h away from x
+		h = (x + h) - x;
+		const T forward = f.eval(x + h), backward = f.eval(x - h);
+		result.evaluations += 2;
+		if (order == 1)
+		{
+			rounding = noise.noise / h;
+			return (forward - backward) / (2 * h);
+		}
+		rounding = 4 * noise.noise / (h * h);
+		return (forward - 2 * y + backward) / (h * h);
+	};
+
+	T rounding;
+	T coarse = central(step, rounding);
+	if (!richardson)
+	{
+		result.value = coarse;
+		result.error = rounding;
+		return result;
+	}
+
+	constexpr int max_halvings = 32, max_widenings = 8;
+	T h = step, last = T(NAN);
+	T fine_rounding;
+	T fine = central(h / 2, fine_rounding);
+	//The step is sized for a fourth (or third) derivative as large as f.
+	//When halving it changes nothing beyond rounding, as for a polynomial of
+	//low degree, only rounding is left: widen it while that holds, up to the
+	//length over which f looks smooth.
+	for (int k = 0; k < max_widenings && abs(fine - coarse) <= fine_rounding && 4 * h <= noise.scale; ++k)
+	{
+		fine = coarse;
+		fine_rounding = rounding;
+		h *= 2;
+		coarse = central(h, rounding);
+	}
+
+	result.error = T(INFINITY);
+	for (int k = 0; k < max_halvings; ++k)
+	{
+		h /= 2;
+		if (k == 0)
+			rounding = fine_rounding;
+		else
+			fine = central(h, rounding);
+		const T value = fine + (fine - coarse) / 3;
+		//Successive extrapolations differ by about the error of the older one
+		const T error = (k == 0 ? abs(fine - coarse) / 3 : abs(value - last)) + rounding;
+		if (error > 2 * result.error)
+			break;
+		if (error < result.error)
+		{
+			result.value = value;
+			result.error = error;
+		}
+		if (error <= 2 * rounding)
+			break;
+		last = value;
+		coarse = fine;
+	}
+	return result;
 }
-bool isinfnan(double x)
+//Only the sign is used, to choose the fixed end of the chord method. That is
+//once per solve, so the step is picked from the noise of f like any other,
+//but without Richardson extrapolation.
+template<class F, class T>
+T get_second_difference(const F& f, T x)
 {
-	return std::isnan(x) || std::isinf(x);
+	return estimate_derivative(f, x, 2, false).value;
 }
-double estimate_root(func f, double x1, double x2)
+template<class F, class T>
+T estimate_root(const F& f, T x1, T x2)
 {
-	const double mid = (x1 + x2) / 2;
-	return std::ranges::min({ x1, x2, mid }, {}, [&](double x) { return std::abs(f(x)); });
+	using std::abs;
+	const T mid = (x1 + x2) / 2;
+	return std::ranges::min({ x1, x2, mid }, {}, [&](T x) { return abs(f.eval(x)); });
 }
 
-double run_secant_method(func f, double x_precision, double x1, double x2, size_t max_steps = SIZE_MAX)
+template<class F, class T>
+T run_secant_method(const F& f, T x_precision, T x1, T x2, size_t max_steps = SIZE_MAX)
 {
+	using std::abs;
 	std::cout << "\nSecant method:\n";
 	size_t step = 0;
 	while (true)
 	{
 		if (step == max_steps)
-			return NAN;
+			return T(NAN);
 
-		const double f1 = f(x1);
-		const double f2 = f(x2);
-		const double dx = f(x1) * (x2 - x1) / (f2 - f1);
+		const T f1 = f.eval(x1);
+		const T f2 = f.eval(x2);
+		const T dx = f1 * (x2 - x1) / (f2 - f1);
 		
-		const double x3 = x1 - dx;
-		report_approximation(++step, x3, f(x3));
+		const T x3 = x1 - dx;
+		report_approximation(++step, x3, f.eval(x3));
 
 		if (isinfnan(x3))
-			return NAN;
+			return T(NAN);
 
-		if (std::abs(dx) <= x_precision / 2)
+		if (abs(dx) <= x_precision / 2)
 			return x3;
 
 		x1 = x2;
 		x2 = x3;
 	}
 }
-double run_chord_method(func f, double x_precision, double x1, double x2, size_t max_steps = SIZE_MAX)
+template<class F, class T>
+T run_chord_method(const F& f, T x_precision, T x1, T x2, size_t max_steps = SIZE_MAX)
 {
+	using std::abs;
 	std::cout << "\nChord method:\n";
 	size_t step = 0;
-	if (!sign_matches(f(x1), get_second_difference(f, x1)))
+	if (!sign_matches(f.eval(x1), get_second_difference(f, x1)))
 		std::swap(x1, x2);
 
 	while (true)
 	{
 		if (step == max_steps)
-			return NAN;
+			return T(NAN);
 
-		const double f1 = f(x1);
-		const double f2 = f(x2);
-		const double dx = f(x2) * (x2 - x1) / (f2 - f1);
+		const T f1 = f.eval(x1);
+		const T f2 = f.eval(x2);
+		const T dx = f2 * (x2 - x1) / (f2 - f1);
 
-		const double x3 = x2 - dx;
-		report_approximation(++step, x3, f(x3));
+		const T x3 = x2 - dx;
+		report_approximation(++step, x3, f.eval(x3));
 
 		if (isinfnan(x3))
-			return NAN;
+			return T(NAN);
 
-		if (std::abs(dx) <= x_precision / 2)
+		if (abs(dx) <= x_precision / 2)
 			return x3;
 
 		x2 = x3;
 	}
 }
-double run_dichotomy_method(func f, double x_precision, double x1, double x2, size_t max_steps = SIZE_MAX)
+template<class F, class T>
+T run_dichotomy_method(const F& f, T x_precision, T x1, T x2, size_t max_steps = SIZE_MAX)
 {
+	using std::abs;
 	std::cout << "\nDichotomy method:\n";
-	const double s1 = sign(f(x1));
-	const double s2 = sign(f(x2));
+	const T s1 = sign(f.eval(x1));
+	const T s2 = sign(f.eval(x2));
 	if (s1 == 0)
 		return x1;
 	if (s2 == 0)
 		return x2;
 	if (s1 == s2)
-		return NAN;
+		return T(NAN);
 
 	if (s1 != 1)
 		std::swap(x1, x2);
@@ -129,18 +391,18 @@ double run_dichotomy_method(func f, double x_precision, double x1, double x2, si
 	while (true)
 	{
 		if (step++ == max_steps)
-			return NAN;
+			return T(NAN);
 
-		const double mid = (x1 + x2) / 2;
+		const T mid = (x1 + x2) / 2;
 
-		const double length = std::abs(x2 - x1);
+		const T length = abs(x2 - x1);
 		if (length <= x_precision)
 			return mid;
 
-		const double mid_val = f(mid);
+		const T mid_val = f.eval(mid);
 		report_approximation(step, mid, mid_val);
 
-		const double mid_sign = sign(mid_val);
+		const T mid_sign = sign(mid_val);
 
 		if (mid_sign == 0)
 			return mid;
@@ -150,102 +412,555 @@ double run_dichotomy_method(func f, double x_precision, double x1, double x2, si
 		else if (mid_sign == -1)
 			x2 = mid;
 		else
-			return NAN;
+			return T(NAN);
+	}
+}
+//Brent's method keeps a bracket [b, c] with |f(b)| <= |f(c)| and steps from
+//b by inverse quadratic interpolation through a, b and c, or by the secant
+//through a and b when a == c. The step is replaced by bisection when it lands
+//outside the bracket or when the steps stop halving. Every step moves b by at
+//least tol, so with n = log2((c - b) / tol) dichotomy steps the method needs
+//at most about n^2 steps.
+template<class F, class T>
+T run_brent_method(const F& f, T x_precision, T x1, T x2, size_t max_steps = SIZE_MAX)
+{
+	using std::abs, std::copysign;
+	std::cout << "\nBrent method:\n";
+	T a = x1, b = x2;
+	T fa = f.eval(a), fb = f.eval(b);
+	if (sign(fa) == 0)
+		return a;
+	if (sign(fb) == 0)
+		return b;
+	if (isinfnan(fa) || isinfnan(fb) || sign(fa) == sign(fb))
+		return T(NAN);
+
+	T c = a, fc = fa;
+	T d = b - a, e = d;
+	size_t step = 0;
+	while (true)
+	{
+		if (step == max_steps)
+			return T(NAN);
+
+		if (sign(fb) == sign(fc))
+		{
+			c = a;
+			fc = fa;
+			d = e = b - a;
+		}
+		if (abs(fc) < abs(fb))
+		{
+			a = b;
+			b = c;
+			c = a;
+			fa = fb;
+			fb = fc;
+			fc = fa;
+		}
+
+		const T tol = 2 * std::numeric_limits<T>::epsilon() * abs(b) + x_precision / 2;
+		const T m = (c - b) / 2;
+		if (abs(m) <= tol || fb == 0)
+			return b;
+
+		if (abs(e) >= tol && abs(fa) > abs(fb))
+		{
+			const T s = fb / fa;
+			T p, q;
+			if (a == c)
+			{
+				p = 2 * m * s;
+				q = 1 - s;
+			}
+			else
+			{
+				const T qa = fa / fc, r = fb / fc;
+				p = s * (2 * m * qa * (qa - r) - (b - a) * (r - 1));
+				q = (qa - 1) * (r - 1) * (s - 1);
+			}
+			if (p > 0)
+				q = -q;
+			else
+				p = -p;
+
+			if (2 * p < std::min(3 * m * q - abs(tol * q), abs(e * q)))
+			{
+				e = d;
+				d = p / q;
+			}
+			else
+				d = e = m;
+		}
+		else
+			d = e = m;
+
+		a = b;
+		fa = fb;
+		b += abs(d) > tol ? d : copysign(tol, m);
+		fb = f.eval(b);
+		report_approximation(++step, b, fb);
+
+		if (isinfnan(fb))
+			return T(NAN);
+	}
+}
+//Alefeld, Potra and Shi's Algorithm 748 keeps a bracket [a, b] with a < b and
+//two older points d and e. Each iteration takes two steps of inverse cubic
+//interpolation through a, b, d and e, falling back to Newton steps on the
+//quadratic through a, b and d, then a double-length secant step from the
+//better end. A bisection follows if the bracket did not halve. That is about
+//1.65 digits per evaluation on simple roots, against 1.32 for Brent's method.
+//On a multiple root the interpolation keeps landing next to the end with the
+//smaller value, so it is the bisections that do the work, at about three
+//evaluations per halving.
+template<class T>
+T toms748_secant(T a, T b, T fa, T fb)
+{
+	using std::abs;
+	const T tol = 5 * std::numeric_limits<T>::epsilon();
+	const T c = a - fa / (fb - fa) * (b - a);
+	if (c <= a + abs(a) * tol || c >= b - abs(b) * tol)
+		return (a + b) / 2;
+	return c;
+}
+template<class T>
+T toms748_quadratic(T a, T b, T d, T fa, T fb, T fd, int newton_steps)
+{
+	using std::abs;
+	const T slope = (fb - fa) / (b - a);
+	const T curvature = ((fd - fb) / (d - b) - slope) / (d - a);
+	if (curvature == 0 || isinfnan(curvature))
+		return toms748_secant(a, b, fa, fb);
+
+	T c = sign(curvature) == sign(fa) ? a : b;
+	for (int i = 0; i < newton_steps; ++i)
+		c -= (fa + (slope + curvature * (c - b)) * (c - a)) / (slope + curvature * (2 * c - a - b));
+	if (!(c > a && c < b))
+		return toms748_secant(a, b, fa, fb);
+	return c;
+}
+template<class T>
+T toms748_cubic(T a, T b, T d, T e, T fa, T fb, T fd, T fe)
+{
+	const T q11 = (d - e) * fd / (fe - fd);
+	const T q21 = (b - d) * fb / (fd - fb);
+	const T q31 = (a - b) * fa / (fb - fa);
+	const T d21 = (b - d) * fd / (fd - fb);
+	const T d31 = (a - b) * fb / (fb - fa);
+	const T q22 = (d21 - q11) * fb / (fe - fb);
+	const T q32 = (d31 - q21) * fa / (fd - fa);
+	const T d32 = (d31 - q21) * fd / (fd - fa);
+	const T q33 = (d32 - q22) * fa / (fe - fa);
+	const T c = a + q31 + q32 + q33;
+	if (!(c > a && c < b))
+		return toms748_quadratic(a, b, d, fa, fb, fd, 3);
+	return c;
+}
+template<class F, class T>
+T run_toms748_method(const F& f, T x_precision, T x1, T x2, size_t max_steps = SIZE_MAX)
+{
+	using std::abs;
+	std::cout << "\nTOMS 748 method:\n";
+	T a = std::min(x1, x2), b = std::max(x1, x2);
+	T fa = f.eval(a), fb = f.eval(b);
+	if (sign(fa) == 0)
+		return a;
+	if (sign(fb) == 0)
+		return b;
+	if (isinfnan(fa) || isinfnan(fb) || sign(fa) == sign(fb))
+		return T(NAN);
+
+	const T mu = T(0.5);
+	T d = T(NAN), fd = T(NAN), e = T(NAN), fe = T(NAN);
+	size_t step = 0;
+	bool failed = false;
+	//The paper's tole: the bracket is done once it is no wider than 2 * tole
+	//at its better end, and no point is taken closer than 0.7 * tole to its ends
+	auto tolerance = [&](T x)
+	{
+		return 2 * std::numeric_limits<T>::epsilon() * abs(x) + x_precision / 2;
+	};
+	auto converged = [&]
+	{
+		return failed || fa == 0 || b - a <= 2 * tolerance(abs(fa) < abs(fb) ? a : b);
+	};
+	//Evaluates f at c, kept off the ends, and narrows [a, b] to the side with
+	//the sign change. The end that was dropped becomes d.
+	auto narrow = [&](T c)
+	{
+		if (step == max_steps)
+		{
+			failed = true;
+			return;
+		}
+		const T delta = T(0.7) * tolerance(abs(fa) < abs(fb) ? a : b);
+		if (b - a <= 2 * delta)
+			c = a + (b - a) / 2;
+		else if (c <= a + delta)
+			c = a + delta;
+		else if (c >= b - delta)
+			c = b - delta;
+
+		const T fc = f.eval(c);
+		report_approximation(++step, c, fc);
+		if (isinfnan(fc))
+			failed = true;
+		else if (fc == 0)
+		{
+			a = c;
+			fa = 0;
+		}
+		else if (sign(fa) != sign(fc))
+		{
+			d = b;
+			fd = fb;
+			b = c;
+			fb = fc;
+		}
+		else
+		{
+			d = a;
+			fd = fa;
+			a = c;
+			fa = fc;
+		}
+	};
+	//Cubic interpolation needs four distinct values, and there is no e yet
+	//for the first step of the loop
+	auto distinct = [&]
+	{
+		const T min_diff = std::numeric_limits<T>::min() * 32;
+		return abs(fa - fb) >= min_diff && abs(fa - fd) >= min_diff && abs(fa - fe) >= min_diff
+			&& abs(fb - fd) >= min_diff && abs(fb - fe) >= min_diff && abs(fd - fe) >= min_diff;
+	};
+	auto interpolate = [&](int newton_steps)
+	{
+		if (isinfnan(fe) || !distinct())
+			return toms748_quadratic(a, b, d, fa, fb, fd, newton_steps);
+		return toms748_cubic(a, b, d, e, fa, fb, fd, fe);
+	};
+
+	//Step 4.2.1
+	narrow(toms748_secant(a, b, fa, fb));
+	while (!converged())
+	{
+		const T width = b - a;
+
+		//Steps 4.2.3 to 4.2.6
+		const T c = interpolate(2);
+		e = d;
+		fe = fd;
+		narrow(c);
+		if (converged())
+			break;
+		narrow(interpolate(3));
+		if (converged())
+			break;
+
+		//Steps 4.2.7 to 4.2.10, the double-length secant step
+		const bool a_better = abs(fa) < abs(fb);
+		const T u = a_better ? a : b, fu = a_better ? fa : fb;
+		T secant = u - 2 * fu / (fb - fa) * (b - a);
+		if (!(abs(secant - u) <= (b - a) / 2))
+			secant = a + (b - a) / 2;
+		e = d;
+		fe = fd;
+		narrow(secant);
+		if (converged())
+			break;
+
+		//Step 4.2.11, bisect unless the bracket shrank by mu
+		if (b - a < mu * width)
+			continue;
+		e = d;
+		fe = fd;
+		narrow(a + (b - a) / 2);
+	}
+
+	if (failed)
+		return T(NAN);
+	return fa == 0 ? a : (a + b) / 2;
+}
+//Oliveira and Takahashi's ITP method moves the regula falsi point towards the
+//midpoint by k1 * (b - a)^k2, then projects it into a ball around the midpoint
+//whose radius shrinks so that after step j the bracket is no wider than the
+//dichotomy method's after j - n0 steps. Smooth simple roots converge with
+//order up to 2. n0 = 0 leaves no slack: no root takes more steps than the
+//dichotomy method, whose stopping rule n_max repeats.
+template<class F, class T>
+T run_itp_method(const F& f, T x_precision, T x1, T x2, size_t max_steps = SIZE_MAX)
+{
+	using std::abs, std::pow, std::ceil, std::log2, std::ldexp;
+	std::cout << "\nITP method:\n";
+	T a = std::min(x1, x2), b = std::max(x1, x2);
+	T fa = f.eval(a), fb = f.eval(b);
+	if (sign(fa) == 0)
+		return a;
+	if (sign(fb) == 0)
+		return b;
+	if (isinfnan(fa) || isinfnan(fb) || sign(fa) == sign(fb))
+		return T(NAN);
+
+	constexpr int n0 = 0;
+	const T k1 = T(0.2) / (b - a), k2 = 2;
+	const T epsilon = x_precision / 2;
+	const int n_max = int(std::max(T(0), ceil(log2((b - a) / (2 * epsilon))))) + n0;
+
+	size_t step = 0;
+	for (int j = 0; b - a > 2 * epsilon; ++j)
+	{
+		if (step == max_steps)
+			return T(NAN);
+
+		const T mid = a + (b - a) / 2;
+		if (mid <= a || mid >= b)
+			break;
+
+		//Interpolate
+		const T x_f = (fb * a - fa * b) / (fb - fa);
+		//Truncate
+		const T to_mid = mid - x_f;
+		const T sigma = sign(to_mid), delta = k1 * pow(b - a, k2);
+		//No closer than epsilon to the ends, or an end that is already on the
+		//root comes back until the projection forces bisection
+		const T x_t = std::clamp(delta <= abs(to_mid) ? x_f + sigma * delta : mid, a + epsilon, b - epsilon);
+		//Project
+		const T radius = std::max(T(0), ldexp(epsilon, n_max - j) - (b - a) / 2);
+		const T x = abs(x_t - mid) <= radius ? x_t : mid - sigma * radius;
+
+		const T y = f.eval(x);
+		report_approximation(++step, x, y);
+
+		if (isinfnan(y))
+			return T(NAN);
+		if (y == 0)
+			return x;
+		if (sign(y) == sign(fa))
+		{
+			a = x;
+			fa = y;
+		}
+		else
+		{
+			b = x;
+			fb = y;
+		}
 	}
+	return a + (b - a) / 2;
 }
-double run_newthon_method(func f, double x_precision, double x, size_t max_steps = SIZE_MAX)
+template<class F, class T>
+T run_newthon_method(const F& f, T x_precision, T x, size_t max_steps = SIZE_MAX)
 {
+	using std::abs;
 	std::cout << "\nNewthon method:\n";
+	//One dual evaluation per step gives f(x) and the exact f'(x)
 	size_t step = 0;
+	dual<T> y = f.eval(dual<T>(x, 1));
 	while (true)
 	{
 		if (step++ == max_steps)
-			return NAN;
+			return T(NAN);
 		if (isinfnan(x))
-			return NAN;
+			return T(NAN);
 
-		const double dx = f(x) / finite_difference_derivative(f, x);
+		const T dx = y.value / y.derivative;
 		x = x - dx;
-		report_approximation(step, x, f(x));
+		y = f.eval(dual<T>(x, 1));
+		report_approximation(step, x, y.value);
 
 
-		if (std::abs(dx) <= x_precision / 2)
+		if (abs(dx) <= x_precision / 2)
 			return x;
 		if (isinfnan(x))
-			return NAN;
+			return T(NAN);
 	}
 }
-double run_halley_method(func f, double x_precision, double x, size_t max_steps = SIZE_MAX)
+template<class F, class T>
+T run_halley_method(const F& f, T x_precision, T x, size_t max_steps = SIZE_MAX)
 {
+	using std::abs;
 	std::cout << "\nHalley method:\n";
+	//f, f' and f'' from one hyper-dual evaluation per step, all exact
 	size_t step = 0;
+	hyper_dual<T> y = f.eval(make_hyper_dual(x));
 	while (true)
 	{
 		if (step++ == max_steps)
-			return NAN;
+			return T(NAN);
 		if (isinfnan(x))
-			return NAN;
+			return T(NAN);
 
-		const double dfdx = finite_difference_derivative(f, x);
-		const double a = f(x) / dfdx;
-		const double b = (1 - a * finite_difference_second_derivative(f, x) / (2 * dfdx));
-		const double dx = a / b;
+		const T dfdx = y.value.derivative;
+		const T a = y.value.value / dfdx;
+		const T b = (1 - a * y.derivative.derivative / (2 * dfdx));
+		const T dx = a / b;
 		x = x - dx;
-		report_approximation(step, x, f(x));
+		y = f.eval(make_hyper_dual(x));
+		report_approximation(step, x, y.value.value);
 
 
-		if (std::abs(dx) <= x_precision / 2)
+		if (abs(dx) <= x_precision / 2)
 			return x;
 		if (isinfnan(x))
-			return NAN;
+			return T(NAN);
+	}
+}
+//Householder's method of order d steps by -g[d-1] / g[d], where g is the
+//Taylor series of 1/f at x. Order 1 is Newton's method and order 2 Halley's;
+//order d converges with order d + 1, from one Taylor evaluation per step.
+constexpr size_t householder_max_order = 6;
+
+template<size_t D, class F, class T>
+T run_householder_steps(const F& f, T x_precision, T x, size_t max_steps)
+{
+	using std::abs;
+	size_t step = 0;
+	taylor<T, D> y = f.eval(taylor<T, D>::variable(x));
+	while (true)
+	{
+		if (step++ == max_steps)
+			return T(NAN);
+		if (isinfnan(x))
+			return T(NAN);
+
+		const taylor<T, D> g = taylor<T, D>(1) / y;
+		const T dx = y.c[0] == 0 ? T(0) : -g.c[D - 1] / g.c[D];
+		x = x - dx;
+		y = f.eval(taylor<T, D>::variable(x));
+		report_approximation(step, x, y.c[0]);
+
+
+		if (abs(dx) <= x_precision / 2)
+			return x;
+		if (isinfnan(x))
+			return T(NAN);
+	}
+}
+template<class F, class T>
+T run_householder_method(const F& f, size_t order, T x_precision, T x, size_t max_steps = SIZE_MAX)
+{
+	std::cout << std::format("\nHouseholder method, order {}:\n", order);
+	switch (order)
+	{
+	case 1: return run_householder_steps<1>(f, x_precision, x, max_steps);
+	case 2: return run_householder_steps<2>(f, x_precision, x, max_steps);
+	case 3: return run_householder_steps<3>(f, x_precision, x, max_steps);
+	case 4: return run_householder_steps<4>(f, x_precision, x, max_steps);
+	case 5: return run_householder_steps<5>(f, x_precision, x, max_steps);
+	case 6: return run_householder_steps<6>(f, x_precision, x, max_steps);
+	default: return T(NAN);
 	}
 }
-double run_simple_iterations_method(func f, double x_precision, double x1, double x2, size_t max_steps = SIZE_MAX)
+template<class F, class T>
+T run_simple_iterations_method(const F& f, T x_precision, T x1, T x2, size_t max_steps = SIZE_MAX)
 {
+	using std::abs, std::copysign;
 	std::cout << "\nSimple iterations method:\n";
-	double lambda, x;
+	T lambda, x;
 	{
-		double dfdx1 = finite_difference_derivative(f, x1);
-		double dfdx2 = finite_difference_derivative(f, x2);
+		T dfdx1 = f.eval(dual<T>(x1, 1)).derivative;
+		T dfdx2 = f.eval(dual<T>(x2, 1)).derivative;
 
 		if (sign(dfdx1) != sign(dfdx2))
 		{
 			std::cout << "function rejected: derivative's sign alternates\n";
-			return NAN;
+			return T(NAN);
 		}
 
-		double adfdx1 = std::copysign(dfdx1, 1);
-		double adfdx2 = std::copysign(dfdx2, 1);
+		T adfdx1 = copysign(dfdx1, T(1));
+		T adfdx2 = copysign(dfdx2, T(1));
 
-		const double max_derivative = std::max(adfdx1, adfdx2);
+		const T max_derivative = std::max(adfdx1, adfdx2);
 		if (max_derivative == 0)
-			return NAN;
-		lambda = std::copysign(1, dfdx1) / max_derivative;
+			return T(NAN);
+		lambda = copysign(T(1), dfdx1) / max_derivative;
 		
 		x = estimate_root(f, x1, x2);
-		report_approximation(0, x, f(x));
+		report_approximation(0, x, f.eval(x));
 	}
 
 	size_t step = 0;
 	while (true)
 	{
 		if (step++ == max_steps)
-			return NAN;
+			return T(NAN);
 		if (isinfnan(x))
-			return NAN;
+			return T(NAN);
 
-		const double y = f(x), dx = lambda * y;
+		const T y = f.eval(x), dx = lambda * y;
 		x -= dx;
 		report_approximation(step, x, y);
 
-		if (std::abs(dx) < x_precision / 2)
+		if (abs(dx) < x_precision / 2)
 			return x;
 	}
 }
 
+struct root_bracket
+{
+	double x1, x2;
+};
+
+//Sign changes of f between evenly spaced samples of [l, r], scanned in single
+//precision. A float result that is not finite or not normal may have lost its
+//sign to overflow or underflow, so those samples are evaluated again in double,
+//and so are the endpoints of every bracket before it is reported. An overflow
+//or underflow in an intermediate value that still gives a finite, normal y
+//goes unnoticed, so a sign lost that way can hide a sign change or report a
+//false one.
+std::vector<root_bracket> find_root_brackets(func f, double l, double r, size_t samples)
+{
+	std::vector<root_bracket> brackets;
+	if (samples < 2)
+		return brackets;
+
+	constexpr size_t chunk = 4096;
+	std::vector<float> xs(chunk), ys(chunk);
+	double last_x = NAN, last_sign = 0;
+	for (size_t base = 0; base < samples; base += chunk)
+	{
+		const size_t count = std::min(chunk, samples - base);
+		auto grid = [&](size_t i) { return l + (r - l) * double(base + i) / double(samples - 1); };
+		for (size_t i = 0; i < count; ++i)
+			xs[i] = float(grid(i));
+		f.evaluate(std::span<const float>(xs.data(), count), std::span<float>(ys.data(), count));
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			const double x = grid(i);
+			const float y = ys[i];
+			const bool reliable = std::isfinite(xs[i]) && std::isfinite(y) && std::abs(y) >= std::numeric_limits<float>::min();
+			const double s = sign(reliable ? y : f(x));
+			if (s != s)
+			{
+				last_sign = 0;
+				continue;
+			}
+			if (s == 0)
+				continue;
+
+			if (s == -last_sign && sign(f(last_x)) * sign(f(x)) == -1)
+				brackets.push_back({ last_x, x });
+			last_x = x;
+			last_sign = s;
+		}
+	}
+	return brackets;
+}
+
 
-int main()
+int main(int argc, char** argv)
 {
+	if (argc > 1 && std::string_view(argv[1]) == "--bench")
+	{
+		run_benchmarks();
+		return 0;
+	}
+	if (argc > 1 && std::string_view(argv[1]) == "--check-math")
+		return run_math_check();
+	const bool ahead_of_time = argc > 1 && std::string_view(argv[1]) == "--aot";
+
 	formula f("");
 
 	while (true)
@@ -260,40 +975,139 @@ int main()
 			break;
 		std::cout << "error: " << str << "\nstarting at " << std::string_view(perr, std::min<size_t>(10, strlen(perr))) << "\n";
 	}
+	if (ahead_of_time && !f.compile_ahead_of_time())
+		std::cout << "ahead-of-time compilation failed, using the JIT\n";
 
-	const double prec = 1e-8, l = -2, r = 3, x0 = (l + r) / 2;
+	const double prec = 1e-8, l = -2, r = 3;
 	run_secant_method(f, prec, l, r, 100);
 	run_chord_method(f, prec, l, r, 100);
-	run_dichotomy_method(f, prec, l, r, 100);
-	run_newthon_method(f, prec, x0, 100);
-	run_halley_method(f, prec, x0, 100);
 	run_simple_iterations_method(f, prec, l, r, 100);
+
+	//The float scan isolates the roots, and each one is refined in double.
+	//Without a sign change the bracketing methods get all of [l, r].
+	auto brackets = find_root_brackets(f, l, r, 1000);
+	std::cout << "\nSign changes:\n";
+	for (auto&& [x1, x2] : brackets)
+		std::cout << std::format("[{:+.16g}, {:+.16g}]\n", x1, x2);
+	if (brackets.empty())
+		brackets.push_back({ l, r });
+
+	for (auto&& [x1, x2] : brackets)
+	{
+		const double x0 = (x1 + x2) / 2;
+		std::cout << std::format("\nOn [{:+.16g}, {:+.16g}]:\n", x1, x2);
+		run_dichotomy_method(f, prec, x1, x2, 100);
+		run_brent_method(f, prec, x1, x2, 100);
+		run_toms748_method(f, prec, x1, x2, 100);
+		run_itp_method(f, prec, x1, x2, 100);
+		run_newthon_method(f, prec, x0, 100);
+		run_halley_method(f, prec, x0, 100);
+		run_householder_method(f, 3, prec, x0, 100);
+	}
 }
 
 
 
 #include <charconv>
+#include <cfloat>
 #include <unordered_map>
 
+using unary_function = double(*)(double);
+using binary_func = double(*)(double, double);
+
+enum class node_type
+{
+	literal,
+	variable,
+	negation,
+	function,
+	binary,
+};
+
+struct expression_node
+{
+	node_type type = node_type::literal;
+	double value = NAN;
+	unary_function function = nullptr;
+	binary_func op = nullptr;
+	std::unique_ptr<expression_node> lhs, rhs;
+};
+using expression = std::unique_ptr<expression_node>;
+
+expression make_literal(double value)
+{
+	auto node = std::make_unique<expression_node>();
+	node->type = node_type::literal;
+	node->value = value;
+	return node;
+}
+expression make_variable()
+{
+	auto node = std::make_unique<expression_node>();
+	node->type = node_type::variable;
+	return node;
+}
+expression make_negation(expression arg)
+{
+	auto node = std::make_unique<expression_node>();
+	node->type = node_type::negation;
+	node->lhs = std::move(arg);
+	return node;
+}
+expression make_function(unary_function function, expression arg)
+{
+	auto node = std::make_unique<expression_node>();
+	node->type = node_type::function;
+	node->function = function;
+	node->lhs = std::move(arg);
+	return node;
+}
+expression make_binary(binary_func op, expression lhs, expression rhs)
+{
+	auto node = std::make_unique<expression_node>();
+	node->type = node_type::binary;
+	node->op = op;
+	node->lhs = std::move(lhs);
+	node->rhs = std::move(rhs);
+	return node;
+}
+
+double evaluate(const expression_node& node, double x)
+{
+	switch (node.type)
+	{
+	case node_type::literal:
+		return node.value;
+	case node_type::variable:
+		return x;
+	case node_type::negation:
+		return -evaluate(*node.lhs, x);
+	case node_type::function:
+		return node.function(evaluate(*node.lhs, x));
+	case node_type::binary:
+		return node.op(evaluate(*node.lhs, x), evaluate(*node.rhs, x));
+	}
+	return NAN;
+}
+
+
 struct parse_context
 {
 	parse_context(const std::string_view& str) noexcept;
 
 	const char* p = nullptr;
 	const char* pe = nullptr;
-	double arg = NAN;
 	std::string error_message;
-	bool dry = false;
 };
 
-bool try_parse_literal(parse_context& cntxt, double& var);
-bool try_parse_variable(parse_context& cntxt, double& var);
-bool try_parse_function(parse_context& cntxt, double& var);
-bool parse_expression(parse_context& cntxt, double& var);
+bool try_parse_literal(parse_context& cntxt, expression& var);
+bool try_parse_variable(parse_context& cntxt, expression& var);
+bool try_parse_function(parse_context& cntxt, expression& var);
+bool parse_expression(parse_context& cntxt, expression& var);
 
 template<class T>
 bool try_match_dictionary(
-	const std::unordered_map<std::string_view, T>& map, 
+	const std::unordered_map<std::string_view, T>& map,
 	parse_context& cntxt, T& result, std::string_view postfix = "")
 {
 	const size_t leftover_len = cntxt.pe - cntxt.p;
@@ -319,40 +1133,45 @@ bool try_match_dictionary(
 	return false;
 }
 
-bool try_parse_literal(parse_context& cntxt, double& var)
+bool try_parse_literal(parse_context& cntxt, expression& var)
 {
 	auto& p = cntxt.p;
 	auto& pe = cntxt.pe;
-	auto result = std::from_chars(p, pe, var);
+	double value;
+	auto result = std::from_chars(p, pe, value);
 	p = result.ptr;
-	return result.ec == std::errc{};
+	if (result.ec != std::errc{})
+		return false;
+	var = make_literal(value);
+	return true;
 }
-bool try_parse_variable(parse_context& cntxt, double& var)
+bool try_parse_variable(parse_context& cntxt, expression& var)
 {
 	auto& p = cntxt.p;
 	auto& pe = cntxt.pe;
-	auto& arg = cntxt.arg;
 	if (p == pe)
 		return false;
 	const bool is_match = *p == 'x';
 	if (is_match)
-		var = arg;
+		var = make_variable();
 	p += is_match;
 	return is_match;
 }
-bool try_parse_function(parse_context& cntxt, double& var)
-{
-	using unary_function = double(*)(double);
 
+double fn_ctg(double x) { return 1 / tan(x); }
+double fn_sqr(double x) { return x * x; }
+
+bool try_parse_function(parse_context& cntxt, expression& var)
+{
 	static const  std::unordered_map<std::string_view, unary_function> functions = {
 		{ "sin", &sin },
 		{ "cos", &cos },
 		{ "tan", &tan },
-		{ "ctg", [](double x) { return 1 / tan(x); }},
+		{ "ctg", &fn_ctg },
 		{ "sqrt", &sqrt },
 		{ "cbrt", &cbrt },
-		{ "sqr", [](double x) { return x * x; }},
-		{ "abs", &abs },
+		{ "sqr", &fn_sqr },
+		{ "abs", &fabs },
 		{ "exp", &exp },
 		{ "ln", &log },
 		{ "lg", &log10 },
@@ -361,13 +1180,12 @@ bool try_parse_function(parse_context& cntxt, double& var)
 
 	auto& p = cntxt.p;
 	auto& pe = cntxt.pe;
-	const size_t leftover_length = pe - p;
 
 	unary_function parsed_func_ptr;
 	if (!try_match_dictionary(functions, cntxt, parsed_func_ptr, "("))
 		return false;
 
-	double func_arg;
+	expression func_arg;
 	if (!parse_expression(cntxt, func_arg))
 		return false;
 
@@ -375,35 +1193,32 @@ bool try_parse_function(parse_context& cntxt, double& var)
 		return false;
 	++p;
 
-	if (cntxt.dry)
-		var = 0;
-	else
-		var = parsed_func_ptr(func_arg);
+	var = make_function(parsed_func_ptr, std::move(func_arg));
 	return true;
 }
 bool is_unary_operator(char c)
 {
 	return std::string_view("+-").find(c) != std::string::npos;
 }
-bool try_parse_unary_expr(parse_context& cntxt, double& var)
+bool try_parse_unary_expr(parse_context& cntxt, expression& var)
 {
 	auto& p = cntxt.p;
 	auto& pe = cntxt.pe;
-	
+
 	if (p == pe)
 		return false;
 
 	char op = *p;
 	if (!is_unary_operator(op))
 		return false;
-	
+
 	++p;
 	bool parse_ok = parse_expression(cntxt, var);
 	if (parse_ok && op == '-')
-		var = -var;
+		var = make_negation(std::move(var));
 	return parse_ok;
 }
-bool try_parse_nested_expression(parse_context& cntxt, double& var)
+bool try_parse_nested_expression(parse_context& cntxt, expression& var)
 {
 	if (cntxt.p == cntxt.pe || *cntxt.p != '(')
 		return false;
@@ -416,7 +1231,7 @@ bool try_parse_nested_expression(parse_context& cntxt, double& var)
 	++cntxt.p;
 	return true;
 }
-bool try_parse_operand(parse_context& cntxt, double& var)
+bool try_parse_operand(parse_context& cntxt, expression& var)
 {
 	parse_context cntxt_copy = cntxt;
 
@@ -431,7 +1246,7 @@ bool try_parse_operand(parse_context& cntxt, double& var)
 	if (try_parse_function(cntxt, var))
 		return true;
 	cntxt = cntxt_copy;
-	
+
 	if (try_parse_nested_expression(cntxt, var))
 		return true;
 	//cntxt = cntxt_copy;
@@ -439,10 +1254,9 @@ bool try_parse_operand(parse_context& cntxt, double& var)
 	return false;
 }
 
-using binary_func = double(*)(double, double);
 struct operand
 {
-	double value;
+	expression value;
 	binary_func next_operator = nullptr;
 };
 
@@ -458,7 +1272,7 @@ bool takes_precedence(binary_func op1, binary_func op2)
 {
 	if (op1 == op_power)
 		return true;
-	
+
 	static const std::unordered_map<binary_func, int> operator_precedence = {
 		{ op_plus, 1 },
 		{ op_minus, 1 },
@@ -472,7 +1286,7 @@ bool takes_precedence(binary_func op1, binary_func op2)
 	return operator_precedence.at(op1) > operator_precedence.at(op2);
 }
 
-bool try_parse_binary_expr(parse_context& cntxt, double& var, operand* p_operand1 = nullptr)
+bool try_parse_binary_expr(parse_context& cntxt, expression& var, operand* p_operand1 = nullptr)
 {
 	static const std::unordered_map<std::string_view, binary_func> binary_operators = {
 		{"+", op_plus},
@@ -496,7 +1310,7 @@ bool try_parse_binary_expr(parse_context& cntxt, double& var, operand* p_operand
 
 		if (p == pe || *p == ')')
 		{
-			var = _operand1_local.value;
+			var = std::move(_operand1_local.value);
 			return true;
 		}
 
@@ -513,10 +1327,7 @@ bool try_parse_binary_expr(parse_context& cntxt, double& var, operand* p_operand
 		return false;
 	if (p == pe || *p == ')')
 	{
-		if (cntxt.dry)
-			var = 0;
-		else
-			var = operand1.next_operator(operand1.value, operand2.value);
+		var = make_binary(operand1.next_operator, std::move(operand1.value), std::move(operand2.value));
 		return true;
 	}
 
@@ -525,20 +1336,20 @@ bool try_parse_binary_expr(parse_context& cntxt, double& var, operand* p_operand
 
 	if (takes_precedence(operand2.next_operator, operand1.next_operator))
 	{
-		double rest;
+		expression rest;
 		if (!try_parse_binary_expr(cntxt, rest, &operand2))
 			return false;
-		var = operand1.next_operator(operand1.value, rest);
+		var = make_binary(operand1.next_operator, std::move(operand1.value), std::move(rest));
 		return true;
 	}
 	else
 	{
-		operand2.value = operand1.next_operator(operand1.value, operand2.value);
+		operand2.value = make_binary(operand1.next_operator, std::move(operand1.value), std::move(operand2.value));
 		return try_parse_binary_expr(cntxt, var, &operand2);
 	}
 }
 
-bool parse_expression(parse_context& cntxt, double& var)
+bool parse_expression(parse_context& cntxt, expression& var)
 {
 	if (cntxt.p == cntxt.pe)
 		return false;
@@ -560,65 +1371,4441 @@ bool parse_expression(parse_context& cntxt, double& var)
 	return false;
 }
 
-formula::formula(const std::string& expression)
+size_t count_nodes(const expression_node& node)
 {
-	this->m_expr.reserve(expression.size());
-	for (auto&& c : expression)
-	{
-		if (!std::isblank(c))
-			this->m_expr += c;
-	}
+	size_t count = 1;
+	if (node.lhs)
+		count += count_nodes(*node.lhs);
+	if (node.rhs)
+		count += count_nodes(*node.rhs);
+	return count;
 }
 
-bool formula::validate(std::string& err_msg, const char*& err_pos) const noexcept
+bool is_literal(const expression_node& node, double value)
 {
-	int parentheses_level = 0;
-	for (auto&& c : this->m_expr)
+	return node.type == node_type::literal && std::bit_cast<uint64_t>(node.value) == std::bit_cast<uint64_t>(value);
+}
+bool is_constant(const expression_node& node)
+{
+	switch (node.type)
 	{
-		if (c == '(')
-			++parentheses_level;
-		if (c == ')')
-			--parentheses_level;
-		if (parentheses_level < 0)
+	case node_type::literal:
+		return true;
+	case node_type::variable:
+		return false;
+	case node_type::negation:
+	case node_type::function:
+		return node.lhs->type == node_type::literal;
+	case node_type::binary:
+		return node.lhs->type == node_type::literal && node.rhs->type == node_type::literal;
+	}
+	return false;
+}
+
+//Only rewrites that give the same result for every input, signed zeros and infinities included.
+//y^2 is the exception: it is canonicalized to sqr(y), which is correctly rounded.
+bool rewrite(expression& node)
+{
+	auto& lhs = node->lhs;
+	auto& rhs = node->rhs;
+
+	switch (node->type)
+	{
+	case node_type::negation:
+		if (lhs->type == node_type::negation)
 		{
-			err_pos = &c;
-			err_msg = "unexpected ')'";
+			node = std::move(lhs->lhs);
+			return true;
+		}
+		return false;
+
+	case node_type::function:
+		if ((node->function == &fn_sqr || node->function == &fabs) && lhs->type == node_type::negation)
+		{
+			lhs = std::move(lhs->lhs);
+			return true;
+		}
+		return false;
+
+	case node_type::binary:
+		break;
+
+	default:
+		return false;
+	}
+
+	const binary_func op = node->op;
+	const bool lhs_negated = lhs->type == node_type::negation;
+	const bool rhs_negated = rhs->type == node_type::negation;
+
+	if (op == op_multiply || op == op_divide)
+	{
+		if (is_literal(*rhs, 1))
+			node = std::move(lhs);
+		else if (is_literal(*rhs, -1))
+			node = make_negation(std::move(lhs));
+		else if (op == op_multiply && is_literal(*lhs, 1))
+			node = std::move(rhs);
+		else if (op == op_multiply && is_literal(*lhs, -1))
+			node = make_negation(std::move(rhs));
+		else if (lhs_negated && rhs_negated)
+			node = make_binary(op, std::move(lhs->lhs), std::move(rhs->lhs));
+		else
 			return false;
+		return true;
+	}
+	if (op == op_plus)
+	{
+		if (is_literal(*rhs, -0.0))
+			node = std::move(lhs);
+		else if (is_literal(*lhs, -0.0))
+			node = std::move(rhs);
+		else if (rhs_negated)
+			node = make_binary(op_minus, std::move(lhs), std::move(rhs->lhs));
+		else if (lhs_negated)
+			node = make_binary(op_minus, std::move(rhs), std::move(lhs->lhs));
+		else
+			return false;
+		return true;
+	}
+	if (op == op_minus)
+	{
+		if (is_literal(*rhs, 0.0))
+			node = std::move(lhs);
+		else if (rhs_negated)
+			node = make_binary(op_plus, std::move(lhs), std::move(rhs->lhs));
+		else
+			return false;
+		return true;
+	}
+	if (op == op_power)
+	{
+		if (is_literal(*rhs, 1))
+			node = std::move(lhs);
+		else if (is_literal(*rhs, 0))
+			node = make_literal(1);
+		else if (is_literal(*rhs, 2))
+			node = make_function(&fn_sqr, std::move(lhs));
+		else
+			return false;
+		return true;
+	}
+	return false;
+}
+
+void simplify(expression& node)
+{
+	if (node->lhs)
+		simplify(node->lhs);
+	if (node->rhs)
+		simplify(node->rhs);
+
+	while (true)
+	{
+		if (node->type != node_type::literal && is_constant(*node))
+		{
+			node = make_literal(evaluate(*node, NAN));
+			return;
 		}
+		if (!rewrite(node))
+			return;
+		if (node->lhs)
+			simplify(node->lhs);
+		if (node->rhs)
+			simplify(node->rhs);
 	}
-	if (parentheses_level != 0)
+}
+size_t simplify_and_count(expression& root)
+{
+	const size_t before = count_nodes(*root);
+	simplify(root);
+	return before - count_nodes(*root);
+}
+
+
+struct dag_node
+{
+	node_type type = node_type::literal;
+	double value = NAN;
+	unary_function function = nullptr;
+	binary_func op = nullptr;
+	uint32_t lhs = 0, rhs = 0;
+};
+
+struct expression_dag
+{
+	std::vector<dag_node> nodes;
+	std::vector<uint32_t> uses;
+	uint32_t root = 0;
+};
+
+struct dag_node_hash
+{
+	size_t operator()(const dag_node& node) const noexcept
 	{
-		err_pos = this->m_expr.data() + this->m_expr.size();
-		err_msg = "no ')' to match '('";
-		return false;
+		size_t hash = std::hash<uint64_t>{}(std::bit_cast<uint64_t>(node.value));
+		auto combine = [&](size_t value) { hash ^= value + 0x9E3779B97F4A7C15 + (hash << 6) + (hash >> 2); };
+		combine(size_t(node.type));
+		combine(std::hash<unary_function>{}(node.function));
+		combine(std::hash<binary_func>{}(node.op));
+		combine(node.lhs);
+		combine(node.rhs);
+		return hash;
+	}
+};
+struct dag_node_equal
+{
+	bool operator()(const dag_node& a, const dag_node& b) const noexcept
+	{
+		return a.type == b.type && std::bit_cast<uint64_t>(a.value) == std::bit_cast<uint64_t>(b.value) &&
+			a.function == b.function && a.op == b.op && a.lhs == b.lhs && a.rhs == b.rhs;
 	}
+};
 
-	parse_context cntxt(this->m_expr);
-	cntxt.dry = true;
+class dag_builder
+{
+	expression_dag& m_dag;
+	std::unordered_map<dag_node, uint32_t, dag_node_hash, dag_node_equal> m_interned;
 
-	double unused;
-	bool dry_parse_result = parse_expression(cntxt, unused);
-	
-	err_msg = std::move(cntxt.error_message);
-	if (!dry_parse_result && err_msg.empty())
-		err_msg = "failed to classify token sequence";
-	err_pos = cntxt.p;
-	return dry_parse_result;
+	uint32_t intern(const dag_node& node)
+	{
+		auto [it, inserted] = this->m_interned.try_emplace(node, uint32_t(this->m_dag.nodes.size()));
+		if (!inserted)
+			return it->second;
+
+		this->m_dag.nodes.push_back(node);
+		this->m_dag.uses.push_back(0);
+		if (node.type == node_type::negation || node.type == node_type::function || node.type == node_type::binary)
+			++this->m_dag.uses[node.lhs];
+		if (node.type == node_type::binary)
+			++this->m_dag.uses[node.rhs];
+		return it->second;
+	}
+
+	uint32_t intern_unary(node_type type, unary_function function, uint32_t arg)
+	{
+		dag_node result;
+		result.type = type;
+		result.function = function;
+		result.lhs = arg;
+		return this->intern(result);
+	}
+	uint32_t intern_binary(binary_func op, uint32_t lhs, uint32_t rhs)
+	{
+		if ((op == op_plus || op == op_multiply) && lhs > rhs)
+			std::swap(lhs, rhs);
+
+		dag_node result;
+		result.type = node_type::binary;
+		result.op = op;
+		result.lhs = lhs;
+		result.rhs = rhs;
+		return this->intern(result);
+	}
+	uint32_t intern_literal(double value)
+	{
+		dag_node result;
+		result.value = value;
+		return this->intern(result);
+	}
+
+	//x^n for small integer n is a chain of squarings and products, interned so
+	//that x^3, x^5 and x^7 share x^2 and x^4. Each product adds at most one
+	//rounding, so the result is within n-1 ulp of the exact power (pow itself
+	//is within 1 ulp). Half-integer exponents multiply in sqrt(x), which only
+	//differs from pow at x = -0 (sign of zero) and x = -inf (NaN instead of +inf).
+	static constexpr int power_chain_max_exponent = 16;
+
+	uint32_t power_chain(uint32_t base, int exponent)
+	{
+		uint32_t result = UINT32_MAX;
+		uint32_t square = base;
+		while (true)
+		{
+			if (exponent & 1)
+				result = result == UINT32_MAX ? square : this->intern_binary(op_multiply, result, square);
+			exponent >>= 1;
+			if (exponent == 0)
+				return result;
+			square = this->intern_unary(node_type::function, &fn_sqr, square);
+		}
+	}
+	bool try_add_power_chain(uint32_t base, double exponent, uint32_t& result)
+	{
+		if (exponent == -1)
+		{
+			result = this->intern_binary(op_divide, this->intern_literal(1), base);
+			return true;
+		}
+
+		const double doubled = exponent * 2;
+		if (doubled != std::trunc(doubled) || doubled < 1 || doubled > 2 * power_chain_max_exponent)
+			return false;
+
+		const int whole = int(exponent);
+		if (whole == exponent)
+		{
+			result = this->power_chain(base, whole);
+			return true;
+		}
+
+		result = this->intern_unary(node_type::function, &sqrt, base);
+		if (whole != 0)
+			result = this->intern_binary(op_multiply, this->power_chain(base, whole), result);
+		return true;
+	}
+
+public:
+	dag_builder(expression_dag& dag)
+		: m_dag(dag)
+	{
+	}
+
+	uint32_t add(const expression_node& node)
+	{
+		switch (node.type)
+		{
+		case node_type::literal:
+			return this->intern_literal(node.value);
+		case node_type::variable:
+		{
+			dag_node result;
+			result.type = node_type::variable;
+			return this->intern(result);
+		}
+		case node_type::negation:
+			return this->intern_unary(node_type::negation, nullptr, this->add(*node.lhs));
+		case node_type::function:
+			return this->intern_unary(node_type::function, node.function, this->add(*node.lhs));
+		case node_type::binary:
+			break;
+		}
+
+		const uint32_t lhs = this->add(*node.lhs);
+		uint32_t result;
+		if (node.op == op_power && node.rhs->type == node_type::literal && this->try_add_power_chain(lhs, node.rhs->value, result))
+			return result;
+		return this->intern_binary(node.op, lhs, this->add(*node.rhs));
+	}
+};
+
+expression_dag build_dag(const expression_node& root)
+{
+	expression_dag dag;
+	dag_builder builder(dag);
+	dag.root = builder.add(root);
+	return dag;
 }
 
 
-double formula::operator()(double x) const
+enum class opcode : uint8_t
 {
-	double result = std::bit_cast<double>(0xFFFFFFFFFFFFFFFF);
+	push_const,
+	push_x,
+	load,
+	store,
+	negate,
+	plus,
+	minus,
+	multiply,
+	divide,
+	divide_integer,
+	remainder,
+	power,
+	sin,
+	cos,
+	tan,
+	ctg,
+	sqrt,
+	cbrt,
+	sqr,
+	abs,
+	exp,
+	ln,
+	lg,
+	log2,
+	mul_add,
+	mul_sub,
+	neg_mul_add,
+	ret,
+};
 
-	parse_context cntxt(this->m_expr);
-	cntxt.arg = x;
+union bytecode_word
+{
+	opcode op;
+	double value;
+	uint32_t slot;
+};
 
-	parse_expression(cntxt, result);
-	return result;
+constexpr size_t bytecode_max_stack = 256;
+
+opcode get_opcode(unary_function function)
+{
+	static const std::unordered_map<unary_function, opcode> opcodes = {
+		{ &sin, opcode::sin },
+		{ &cos, opcode::cos },
+		{ &tan, opcode::tan },
+		{ &fn_ctg, opcode::ctg },
+		{ &sqrt, opcode::sqrt },
+		{ &cbrt, opcode::cbrt },
+		{ &fn_sqr, opcode::sqr },
+		{ &fabs, opcode::abs },
+		{ &exp, opcode::exp },
+		{ &log, opcode::ln },
+		{ &log10, opcode::lg },
+		{ &log2, opcode::log2 },
+	};
+	return opcodes.at(function);
+}
+opcode get_opcode(binary_func op)
+{
+	static const std::unordered_map<binary_func, opcode> opcodes = {
+		{ op_plus, opcode::plus },
+		{ op_minus, opcode::minus },
+		{ op_multiply, opcode::multiply },
+		{ op_divide, opcode::divide },
+		{ op_divide_integer, opcode::divide_integer },
+		{ op_remainder, opcode::remainder },
+		{ op_power, opcode::power },
+	};
+	return opcodes.at(op);
 }
 
-parse_context::parse_context(const std::string_view& str) noexcept
-	: p(str.data()), pe(str.data() + str.size())
+expression clone(const expression_node& node)
+{
+	auto copy = std::make_unique<expression_node>();
+	copy->type = node.type;
+	copy->value = node.value;
+	copy->function = node.function;
+	copy->op = node.op;
+	if (node.lhs)
+		copy->lhs = clone(*node.lhs);
+	if (node.rhs)
+		copy->rhs = clone(*node.rhs);
+	return copy;
+}
+
+//Text that parses back into the same tree. Everything but literals and x is
+//parenthesized, which sidesteps the grammar's right-to-left operator chains.
+std::string to_string(const expression_node& node)
+{
+	switch (node.type)
+	{
+	case node_type::literal:
+	{
+		const std::string str = std::format("{}", node.value);
+		return std::signbit(node.value) ? "(" + str + ")" : str;
+	}
+	case node_type::variable:
+		return "x";
+	case node_type::negation:
+		return "(-" + to_string(*node.lhs) + ")";
+	case node_type::function:
+		break;
+	case node_type::binary:
+	{
+		std::string_view op;
+		switch (get_opcode(node.op))
+		{
+		case opcode::plus: op = "+"; break;
+		case opcode::minus: op = "-"; break;
+		case opcode::multiply: op = "*"; break;
+		case opcode::divide: op = "/"; break;
+		case opcode::divide_integer: op = "//"; break;
+		case opcode::remainder: op = "%"; break;
+		default: op = "^"; break;
+		}
+		return std::format("({}{}{})", to_string(*node.lhs), op, to_string(*node.rhs));
+	}
+	}
+
+	std::string_view name;
+	switch (get_opcode(node.function))
+	{
+	case opcode::sin: name = "sin"; break;
+	case opcode::cos: name = "cos"; break;
+	case opcode::tan: name = "tan"; break;
+	case opcode::ctg: name = "ctg"; break;
+	case opcode::sqrt: name = "sqrt"; break;
+	case opcode::cbrt: name = "cbrt"; break;
+	case opcode::sqr: name = "sqr"; break;
+	case opcode::abs: name = "abs"; break;
+	case opcode::exp: name = "exp"; break;
+	case opcode::ln: name = "ln"; break;
+	case opcode::lg: name = "lg"; break;
+	default: name = "log2"; break;
+	}
+	return std::format("{}({})", name, to_string(*node.lhs));
+}
+
+//Symbolic derivative with respect to x. nullptr stands for a derivative that
+//is zero for every x, so that constant subtrees add no terms; the result is
+//left for simplify. x//y is treated as piecewise constant, and the derivative
+//of abs is NaN at 0.
+expression derive(const expression_node& node)
+{
+	auto multiply = [](expression a, expression b) { return make_binary(op_multiply, std::move(a), std::move(b)); };
+	auto divide = [](expression a, expression b) { return make_binary(op_divide, std::move(a), std::move(b)); };
+	auto function = [](unary_function f, const expression_node& arg) { return make_function(f, clone(arg)); };
+
+	switch (node.type)
+	{
+	case node_type::literal:
+		return nullptr;
+	case node_type::variable:
+		return make_literal(1);
+	case node_type::negation:
+	{
+		expression da = derive(*node.lhs);
+		return da ? make_negation(std::move(da)) : nullptr;
+	}
+	case node_type::function:
+		break;
+	case node_type::binary:
+	{
+		const expression_node& a = *node.lhs;
+		const expression_node& b = *node.rhs;
+		expression da = derive(a), db = derive(b);
+		switch (get_opcode(node.op))
+		{
+		case opcode::plus:
+			if (!da || !db)
+				return da ? std::move(da) : std::move(db);
+			return make_binary(op_plus, std::move(da), std::move(db));
+		case opcode::minus:
+			if (!db)
+				return da;
+			if (!da)
+				return make_negation(std::move(db));
+			return make_binary(op_minus, std::move(da), std::move(db));
+		case opcode::multiply:
+		{
+			expression lhs = da ? multiply(std::move(da), clone(b)) : nullptr;
+			expression rhs = db ? multiply(clone(a), std::move(db)) : nullptr;
+			if (!lhs || !rhs)
+				return lhs ? std::move(lhs) : std::move(rhs);
+			return make_binary(op_plus, std::move(lhs), std::move(rhs));
+		}
+		case opcode::divide:
+		{
+			if (!db)
+				return da ? divide(std::move(da), clone(b)) : nullptr;
+			expression rhs = divide(multiply(clone(a), std::move(db)), make_function(&fn_sqr, clone(b)));
+			if (!da)
+				return make_negation(std::move(rhs));
+			return make_binary(op_minus, divide(std::move(da), clone(b)), std::move(rhs));
+		}
+		case opcode::divide_integer:
+			return nullptr;
+		case opcode::remainder:
+		{
+			if (!db)
+				return da;
+			expression rhs = multiply(make_binary(op_divide_integer, clone(a), clone(b)), std::move(db));
+			if (!da)
+				return make_negation(std::move(rhs));
+			return make_binary(op_minus, std::move(da), std::move(rhs));
+		}
+		default:
+			break;
+		}
+
+		//a^b: b*a^(b-1)*da + a^b*ln(a)*db, with a literal b-1 when b is literal
+		expression lhs, rhs;
+		if (da)
+		{
+			expression exponent = b.type == node_type::literal ? make_literal(b.value - 1) : make_binary(op_minus, clone(b), make_literal(1));
+			lhs = multiply(multiply(clone(b), make_binary(op_power, clone(a), std::move(exponent))), std::move(da));
+		}
+		if (db)
+			rhs = multiply(multiply(clone(node), function(&log, a)), std::move(db));
+		if (!lhs || !rhs)
+			return lhs ? std::move(lhs) : std::move(rhs);
+		return make_binary(op_plus, std::move(lhs), std::move(rhs));
+	}
+	}
+
+	const expression_node& a = *node.lhs;
+	expression da = derive(a);
+	if (!da)
+		return nullptr;
+
+	expression outer;
+	switch (get_opcode(node.function))
+	{
+	case opcode::sin:
+		outer = function(&cos, a);
+		break;
+	case opcode::cos:
+		outer = make_negation(function(&sin, a));
+		break;
+	case opcode::tan:
+		outer = make_binary(op_plus, make_literal(1), make_function(&fn_sqr, function(&tan, a)));
+		break;
+	case opcode::ctg:
+		outer = make_negation(make_binary(op_plus, make_literal(1), make_function(&fn_sqr, function(&fn_ctg, a))));
+		break;
+	case opcode::sqrt:
+		return divide(std::move(da), multiply(make_literal(2), function(&sqrt, a)));
+	case opcode::cbrt:
+		return divide(std::move(da), multiply(make_literal(3), make_function(&fn_sqr, function(&cbrt, a))));
+	case opcode::sqr:
+		outer = multiply(make_literal(2), clone(a));
+		break;
+	case opcode::abs:
+		outer = divide(clone(a), function(&fabs, a));
+		break;
+	case opcode::exp:
+		outer = function(&exp, a);
+		break;
+	case opcode::ln:
+		return divide(std::move(da), clone(a));
+	case opcode::lg:
+		return divide(std::move(da), multiply(clone(a), make_literal(std::numbers::ln10)));
+	default:
+		return divide(std::move(da), multiply(clone(a), make_literal(std::numbers::ln2)));
+	}
+	return multiply(std::move(outer), std::move(da));
+}
+
+struct bytecode_context
+{
+	const expression_dag& dag;
+	std::vector<bytecode_word> code;
+	std::vector<uint32_t> slot_of;
+	uint32_t slot_count = 0;
+	size_t depth = 0, max_depth = 0;
+};
+
+void emit_bytecode(bytecode_context& cntxt, uint32_t index)
+{
+	const dag_node& node = cntxt.dag.nodes[index];
+	auto& code = cntxt.code;
+
+	if (cntxt.slot_of[index] != UINT32_MAX)
+	{
+		code.push_back({ .op = opcode::load });
+		code.push_back({ .slot = cntxt.slot_of[index] });
+		cntxt.max_depth = std::max(cntxt.max_depth, ++cntxt.depth);
+		return;
+	}
+
+	switch (node.type)
+	{
+	case node_type::literal:
+		code.push_back({ .op = opcode::push_const });
+		code.push_back({ .value = node.value });
+		cntxt.max_depth = std::max(cntxt.max_depth, ++cntxt.depth);
+		return;
+	case node_type::variable:
+		code.push_back({ .op = opcode::push_x });
+		cntxt.max_depth = std::max(cntxt.max_depth, ++cntxt.depth);
+		return;
+	case node_type::negation:
+		emit_bytecode(cntxt, node.lhs);
+		code.push_back({ .op = opcode::negate });
+		break;
+	case node_type::function:
+		emit_bytecode(cntxt, node.lhs);
+		code.push_back({ .op = get_opcode(node.function) });
+		break;
+	case node_type::binary:
+		emit_bytecode(cntxt, node.lhs);
+		emit_bytecode(cntxt, node.rhs);
+		code.push_back({ .op = get_opcode(node.op) });
+		--cntxt.depth;
+		break;
+	}
+
+	if (cntxt.dag.uses[index] > 1)
+	{
+		cntxt.slot_of[index] = cntxt.slot_count++;
+		code.push_back({ .op = opcode::store });
+		code.push_back({ .slot = cntxt.slot_of[index] });
+	}
+}
+std::vector<bytecode_word> compile_bytecode(const expression_dag& dag)
+{
+	bytecode_context cntxt{ dag, {}, {} };
+	cntxt.slot_of.assign(dag.nodes.size(), UINT32_MAX);
+	emit_bytecode(cntxt, dag.root);
+	cntxt.code.push_back({ .op = opcode::ret });
+
+	if (cntxt.max_depth > bytecode_max_stack || cntxt.slot_count > bytecode_max_stack)
+		return {};
+	cntxt.code.shrink_to_fit();
+	return std::move(cntxt.code);
+}
+
+double run_bytecode(const bytecode_word* pc, double x)
+{
+	double stack[bytecode_max_stack];
+	double slots[bytecode_max_stack];
+	double* sp = stack;
+
+	while (true)
+	{
+		switch ((pc++)->op)
+		{
+		case opcode::push_const: *sp++ = (pc++)->value; break;
+		case opcode::push_x: *sp++ = x; break;
+		case opcode::load: *sp++ = slots[(pc++)->slot]; break;
+		case opcode::store: slots[(pc++)->slot] = sp[-1]; break;
+		case opcode::negate: sp[-1] = -sp[-1]; break;
+
+		case opcode::plus: --sp; sp[-1] = sp[-1] + sp[0]; break;
+		case opcode::minus: --sp; sp[-1] = sp[-1] - sp[0]; break;
+		case opcode::multiply: --sp; sp[-1] = sp[-1] * sp[0]; break;
+		case opcode::divide: --sp; sp[-1] = sp[-1] / sp[0]; break;
+		case opcode::divide_integer: --sp; sp[-1] = op_divide_integer(sp[-1], sp[0]); break;
+		case opcode::remainder: --sp; sp[-1] = fmod(sp[-1], sp[0]); break;
+		case opcode::power: --sp; sp[-1] = pow(sp[-1], sp[0]); break;
+
+		case opcode::sin: sp[-1] = sin(sp[-1]); break;
+		case opcode::cos: sp[-1] = cos(sp[-1]); break;
+		case opcode::tan: sp[-1] = tan(sp[-1]); break;
+		case opcode::ctg: sp[-1] = fn_ctg(sp[-1]); break;
+		case opcode::sqrt: sp[-1] = sqrt(sp[-1]); break;
+		case opcode::cbrt: sp[-1] = cbrt(sp[-1]); break;
+		case opcode::sqr: sp[-1] = sp[-1] * sp[-1]; break;
+		case opcode::abs: sp[-1] = fabs(sp[-1]); break;
+		case opcode::exp: sp[-1] = exp(sp[-1]); break;
+		case opcode::ln: sp[-1] = log(sp[-1]); break;
+		case opcode::lg: sp[-1] = log10(sp[-1]); break;
+		case opcode::log2: sp[-1] = log2(sp[-1]); break;
+
+		case opcode::mul_add:
+		case opcode::mul_sub:
+		case opcode::neg_mul_add:
+			return NAN;
+
+		case opcode::ret: return sp[-1];
+		}
+	}
+}
+
+
+#include "simd_math.h"
+
+//One lane, for the scalar tiers
+struct simd_scalar
+{
+	using reg = double;
+	using mask = bool;
+	using ireg = uint64_t;
+	static constexpr size_t width = 1;
+
+	static reg set1(double x) { return x; }
+	static reg add(reg a, reg b) { return a + b; }
+	static reg sub(reg a, reg b) { return a - b; }
+	static reg mul(reg a, reg b) { return a * b; }
+	static reg div(reg a, reg b) { return a / b; }
+	static reg neg(reg a) { return -a; }
+	static reg abs(reg a) { return fabs(a); }
+
+	static reg min(reg a, reg b) { return a < b ? a : b; }
+	static reg max(reg a, reg b) { return a > b ? a : b; }
+	static mask lt(reg a, reg b) { return a < b; }
+	static mask eq(reg a, reg b) { return a == b; }
+	static mask is_nan(reg a) { return a != a; }
+	static mask mask_or(mask a, mask b) { return a || b; }
+	static reg select(mask m, reg a, reg b) { return m ? a : b; }
+
+	static ireg bits(reg a) { return std::bit_cast<ireg>(a); }
+	static reg from_bits(ireg a) { return std::bit_cast<reg>(a); }
+	static ireg iset1(int64_t x) { return ireg(x); }
+	static ireg iand(ireg a, ireg b) { return a & b; }
+	static ireg ior(ireg a, ireg b) { return a | b; }
+	static ireg ixor(ireg a, ireg b) { return a ^ b; }
+	static ireg iadd(ireg a, ireg b) { return a + b; }
+	static ireg shl(ireg a, int n) { return a << n; }
+	static ireg shr(ireg a, int n) { return a >> n; }
+};
+
+//The function table at a given accuracy; exact is libm itself
+template<accuracy A>
+double math_sin(double x)
+{
+	if constexpr (A == accuracy::exact)
+		return sin(x);
+	else
+		return fabs(x) <= simd_trig_limit ? simd_sin<simd_scalar, A>(x) : sin(x);
+}
+template<accuracy A>
+double math_cos(double x)
+{
+	if constexpr (A == accuracy::exact)
+		return cos(x);
+	else
+		return fabs(x) <= simd_trig_limit ? simd_cos<simd_scalar, A>(x) : cos(x);
+}
+template<accuracy A>
+double math_tan(double x)
+{
+	if constexpr (A == accuracy::exact)
+		return tan(x);
+	else
+		return fabs(x) <= simd_trig_limit ? simd_tan<simd_scalar, A>(x, false) : tan(x);
+}
+template<accuracy A>
+double math_ctg(double x)
+{
+	if constexpr (A == accuracy::exact)
+		return fn_ctg(x);
+	else
+		return fabs(x) <= simd_trig_limit ? simd_tan<simd_scalar, A>(x, true) : fn_ctg(x);
+}
+template<accuracy A>
+double math_cbrt(double x)
+{
+	if constexpr (A == accuracy::exact)
+		return cbrt(x);
+	else
+		return simd_cbrt<simd_scalar, A>(x);
+}
+template<accuracy A>
+double math_exp(double x)
+{
+	if constexpr (A == accuracy::exact)
+		return exp(x);
+	else
+		return simd_exp<simd_scalar, A>(x);
+}
+template<accuracy A>
+double math_ln(double x)
+{
+	if constexpr (A == accuracy::exact)
+		return log(x);
+	else
+		return simd_log<simd_scalar, A>(x);
+}
+template<accuracy A>
+double math_lg(double x)
+{
+	if constexpr (A == accuracy::exact)
+		return log10(x);
+	else
+		return simd_log10<simd_scalar, A>(x);
+}
+template<accuracy A>
+double math_log2(double x)
+{
+	if constexpr (A == accuracy::exact)
+		return log2(x);
+	else
+		return simd_log2<simd_scalar, A>(x);
+}
+
+template<class T>
+constexpr bool is_complex = false;
+template<class T>
+constexpr bool is_complex<std::complex<T>> = true;
+
+//std::complex has no cbrt or log2, and its abs is not analytic. These agree
+//with the real functions on the real axis and are analytic next to it, which
+//is what complex-step differentiation needs: abs and cbrt are odd, so the left
+//half plane mirrors the right one. sqrt, ln and pow keep the principal branch.
+template<opcode op, class T>
+std::complex<T> complex_function(std::complex<T> z)
 {
+	if constexpr (op == opcode::sin) return std::sin(z);
+	else if constexpr (op == opcode::cos) return std::cos(z);
+	else if constexpr (op == opcode::tan) return std::tan(z);
+	else if constexpr (op == opcode::ctg) return T(1) / std::tan(z);
+	else if constexpr (op == opcode::sqrt) return std::sqrt(z);
+	else if constexpr (op == opcode::cbrt)
+	{
+		const std::complex<T> w = z.real() < 0 ? -z : z;
+		const std::complex<T> root = std::polar(std::cbrt(std::abs(w)), std::arg(w) / 3);
+		return z.real() < 0 ? -root : root;
+	}
+	else if constexpr (op == opcode::sqr) return z * z;
+	else if constexpr (op == opcode::abs) return z.real() < 0 ? -z : z;
+	else if constexpr (op == opcode::exp) return std::exp(z);
+	else if constexpr (op == opcode::ln) return std::log(z);
+	else if constexpr (op == opcode::lg) return std::log10(z);
+	else if constexpr (op == opcode::log2) return std::log(z) / std::numbers::ln2_v<T>;
+}
+
+//The function table for any scalar type. double goes through the accuracy
+//tiers above; other types use their own overloads, found by ADL.
+template<accuracy A, opcode op, class T>
+T math_function(T x)
+{
+	using std::sin, std::cos, std::tan, std::sqrt, std::cbrt, std::abs, std::exp, std::log, std::log10, std::log2;
+	if constexpr (is_complex<T>)
+		return complex_function<op>(x);
+	else if constexpr (op == opcode::sqrt)
+		return sqrt(x);
+	else if constexpr (op == opcode::sqr)
+		return x * x;
+	else if constexpr (op == opcode::abs)
+		return abs(x);
+	else if constexpr (std::is_same_v<T, double>)
+	{
+		if constexpr (op == opcode::sin) return math_sin<A>(x);
+		else if constexpr (op == opcode::cos) return math_cos<A>(x);
+		else if constexpr (op == opcode::tan) return math_tan<A>(x);
+		else if constexpr (op == opcode::ctg) return math_ctg<A>(x);
+		else if constexpr (op == opcode::cbrt) return math_cbrt<A>(x);
+		else if constexpr (op == opcode::exp) return math_exp<A>(x);
+		else if constexpr (op == opcode::ln) return math_ln<A>(x);
+		else if constexpr (op == opcode::lg) return math_lg<A>(x);
+		else if constexpr (op == opcode::log2) return math_log2<A>(x);
+	}
+	else
+	{
+		if constexpr (op == opcode::sin) return sin(x);
+		else if constexpr (op == opcode::cos) return cos(x);
+		else if constexpr (op == opcode::tan) return tan(x);
+		else if constexpr (op == opcode::ctg) return 1 / tan(x);
+		else if constexpr (op == opcode::cbrt) return cbrt(x);
+		else if constexpr (op == opcode::exp) return exp(x);
+		else if constexpr (op == opcode::ln) return log(x);
+		else if constexpr (op == opcode::lg) return log10(x);
+		else if constexpr (op == opcode::log2) return log2(x);
+	}
+}
+template<class T>
+T math_divide_integer(T a, T b)
+{
+	using std::trunc;
+	return trunc(a / b * (1 + 2 * std::numeric_limits<T>::epsilon()));
+}
+template<class T>
+T math_remainder(T a, T b)
+{
+	using std::fmod;
+	return fmod(a, b);
+}
+template<class T>
+T math_power(T a, T b)
+{
+	using std::pow;
+	return pow(a, b);
+}
+
+//The operators over std::complex, in the spirit of complex_function. The
+//quotient of // is piecewise constant and % moves with a - q * b. Integer
+//powers of a negative base stay off the branch cut of std::pow.
+template<class T>
+std::complex<T> math_divide_integer(std::complex<T> a, std::complex<T> b)
+{
+	return math_divide_integer(a.real(), b.real());
+}
+template<class T>
+std::complex<T> math_remainder(std::complex<T> a, std::complex<T> b)
+{
+	return { std::fmod(a.real(), b.real()), a.imag() - std::trunc(a.real() / b.real()) * b.imag() };
+}
+template<class T>
+std::complex<T> math_power(std::complex<T> a, std::complex<T> b)
+{
+	if (b.imag() != 0)
+		return std::pow(a, b);
+	if (a.real() < 0 && std::trunc(b.real()) == b.real())
+	{
+		const std::complex<T> p = std::pow(-a, b.real());
+		return std::fmod(b.real(), T(2)) == 0 ? p : -p;
+	}
+	return std::pow(a, b.real());
+}
+
+//Forward-mode automatic differentiation: value + derivative * e, with e^2 = 0.
+//A formula evaluated at dual(x, 1) gives f(x) and f'(x) in one pass, exact up
+//to rounding. The math functions are hidden friends, found by ADL from
+//math_function and run_registers. T can itself be a dual.
+template<class T>
+struct dual
+{
+	T value{}, derivative{};
+
+	constexpr dual() = default;
+	constexpr dual(double value)
+		: value(value), derivative(0)
+	{
+	}
+	constexpr dual(T value, T derivative)
+		: value(value), derivative(derivative)
+	{
+	}
+
+	//Zero in every component, unlike == which only compares values
+	static constexpr bool is_zero(const T& x)
+	{
+		if constexpr (std::is_arithmetic_v<T>)
+			return x == 0;
+		else
+			return T::is_zero(x.value) && T::is_zero(x.derivative);
+	}
+
+	friend bool operator==(const dual& a, const dual& b) { return a.value == b.value; }
+	friend auto operator<=>(const dual& a, const dual& b) { return a.value <=> b.value; }
+
+	friend dual operator-(const dual& a) { return { -a.value, -a.derivative }; }
+	friend dual operator+(const dual& a, const dual& b) { return { a.value + b.value, a.derivative + b.derivative }; }
+	friend dual operator-(const dual& a, const dual& b) { return { a.value - b.value, a.derivative - b.derivative }; }
+	friend dual operator*(const dual& a, const dual& b) { return { a.value * b.value, a.derivative * b.value + a.value * b.derivative }; }
+	friend dual operator/(const dual& a, const dual& b)
+	{
+		const T quotient = a.value / b.value;
+		return { quotient, (a.derivative - quotient * b.derivative) / b.value };
+	}
+
+	friend dual sin(const dual& a)
+	{
+		using std::sin, std::cos;
+		return { sin(a.value), cos(a.value) * a.derivative };
+	}
+	friend dual cos(const dual& a)
+	{
+		using std::sin, std::cos;
+		return { cos(a.value), -sin(a.value) * a.derivative };
+	}
+	friend dual tan(const dual& a)
+	{
+		using std::tan;
+		const T t = tan(a.value);
+		return { t, (1 + t * t) * a.derivative };
+	}
+	friend dual sqrt(const dual& a)
+	{
+		using std::sqrt;
+		const T s = sqrt(a.value);
+		return { s, a.derivative / (2 * s) };
+	}
+	friend dual cbrt(const dual& a)
+	{
+		using std::cbrt;
+		const T c = cbrt(a.value);
+		return { c, a.derivative / (3 * c * c) };
+	}
+	//The right derivative at 0
+	friend dual abs(const dual& a)
+	{
+		using std::abs;
+		return { abs(a.value), a.value < 0 ? -a.derivative : a.derivative };
+	}
+	friend dual exp(const dual& a)
+	{
+		using std::exp;
+		const T e = exp(a.value);
+		return { e, e * a.derivative };
+	}
+	friend dual log(const dual& a)
+	{
+		using std::log;
+		return { log(a.value), a.derivative / a.value };
+	}
+	friend dual log10(const dual& a)
+	{
+		using std::log10;
+		return { log10(a.value), a.derivative / (a.value * std::numbers::ln10) };
+	}
+	friend dual log2(const dual& a)
+	{
+		using std::log2;
+		return { log2(a.value), a.derivative / (a.value * std::numbers::ln2) };
+	}
+	friend dual trunc(const dual& a)
+	{
+		using std::trunc;
+		return { trunc(a.value), T(0) };
+	}
+	friend dual fmod(const dual& a, const dual& b)
+	{
+		using std::fmod, std::trunc;
+		return { fmod(a.value, b.value), a.derivative - trunc(a.value / b.value) * b.derivative };
+	}
+	//Only the terms that are not structurally zero, so that a constant
+	//exponent does not bring in log of a negative base
+	friend dual pow(const dual& a, const dual& b)
+	{
+		using std::pow, std::log;
+		const T p = pow(a.value, b.value);
+		T derivative = T(0);
+		if (!is_zero(a.derivative))
+			derivative = b.value * pow(a.value, b.value - 1) * a.derivative;
+		if (!is_zero(b.derivative))
+			derivative = derivative + p * log(a.value) * b.derivative;
+		return { p, derivative };
+	}
+	friend dual math_divide_integer(const dual& a, const dual& b)
+	{
+		return { math_divide_integer(a.value, b.value), T(0) };
+	}
+};
+
+//A dual of duals seeded in both parts carries f in value.value, f' in
+//value.derivative (and again in derivative.value) and f'' in derivative.derivative
+template<class T>
+hyper_dual<T> make_hyper_dual(T x)
+{
+	return { dual<T>(x, 1), dual<T>(1, 0) };
+}
+
+//Truncated Taylor series in the distance from the expansion point:
+//c[k] = f^(k)(x) / k! for k <= N. A formula evaluated at taylor::variable(x)
+//gives every derivative up to N in one pass; the functions use the usual
+//recurrences, with the value itself always from libm.
+template<class T, size_t N>
+struct taylor
+{
+	std::array<T, N + 1> c{};
+
+	constexpr taylor() = default;
+	constexpr taylor(double value)
+	{
+		this->c[0] = T(value);
+	}
+
+	static taylor variable(T x)
+	{
+		taylor result;
+		result.c[0] = x;
+		if constexpr (N > 0)
+			result.c[1] = T(1);
+		return result;
+	}
+
+	//Zero beyond the constant term
+	bool is_constant() const
+	{
+		return std::all_of(this->c.begin() + 1, this->c.end(), [](const T& a) { return a == 0; });
+	}
+
+	friend bool operator==(const taylor& a, const taylor& b) { return a.c[0] == b.c[0]; }
+	friend auto operator<=>(const taylor& a, const taylor& b) { return a.c[0] <=> b.c[0]; }
+
+	friend taylor operator-(const taylor& a)
+	{
+		taylor r;
+		for (size_t k = 0; k <= N; ++k)
+			r.c[k] = -a.c[k];
+		return r;
+	}
+	friend taylor operator+(const taylor& a, const taylor& b)
+	{
+		taylor r;
+		for (size_t k = 0; k <= N; ++k)
+			r.c[k] = a.c[k] + b.c[k];
+		return r;
+	}
+	friend taylor operator-(const taylor& a, const taylor& b)
+	{
+		taylor r;
+		for (size_t k = 0; k <= N; ++k)
+			r.c[k] = a.c[k] - b.c[k];
+		return r;
+	}
+	friend taylor operator*(const taylor& a, const taylor& b)
+	{
+		taylor r;
+		for (size_t k = 0; k <= N; ++k)
+		{
+			r.c[k] = a.c[0] * b.c[k];
+			for (size_t i = 1; i <= k; ++i)
+				r.c[k] = r.c[k] + a.c[i] * b.c[k - i];
+		}
+		return r;
+	}
+	friend taylor operator/(const taylor& a, const taylor& b)
+	{
+		taylor r;
+		for (size_t k = 0; k <= N; ++k)
+		{
+			T sum = a.c[k];
+			for (size_t i = 1; i <= k; ++i)
+				sum = sum - b.c[i] * r.c[k - i];
+			r.c[k] = sum / b.c[0];
+		}
+		return r;
+	}
+
+	friend taylor sin(const taylor& a)
+	{
+		taylor s, c;
+		sin_cos(a, s, c);
+		return s;
+	}
+	friend taylor cos(const taylor& a)
+	{
+		taylor s, c;
+		sin_cos(a, s, c);
+		return c;
+	}
+	//t' = (1 + t^2) a', with u = 1 + t^2 built alongside
+	friend taylor tan(const taylor& a)
+	{
+		using std::tan;
+		taylor t, u;
+		t.c[0] = tan(a.c[0]);
+		u.c[0] = 1 + t.c[0] * t.c[0];
+		for (size_t k = 1; k <= N; ++k)
+		{
+			t.c[k] = derivative_term(a, u, k);
+			for (size_t i = 0; i <= k; ++i)
+				u.c[k] = u.c[k] + t.c[i] * t.c[k - i];
+		}
+		return t;
+	}
+	friend taylor sqrt(const taylor& a)
+	{
+		using std::sqrt;
+		taylor s;
+		s.c[0] = sqrt(a.c[0]);
+		for (size_t k = 1; k <= N; ++k)
+		{
+			T sum = a.c[k];
+			for (size_t i = 1; i < k; ++i)
+				sum = sum - s.c[i] * s.c[k - i];
+			s.c[k] = sum / (2 * s.c[0]);
+		}
+		return s;
+	}
+	friend taylor cbrt(const taylor& a)
+	{
+		using std::cbrt;
+		return real_power(a, T(1) / 3, cbrt(a.c[0]));
+	}
+	//The right derivatives at 0
+	friend taylor abs(const taylor& a)
+	{
+		using std::abs;
+		taylor r = a.c[0] < 0 ? -a : a;
+		r.c[0] = abs(a.c[0]);
+		return r;
+	}
+	friend taylor exp(const taylor& a)
+	{
+		using std::exp;
+		taylor e;
+		e.c[0] = exp(a.c[0]);
+		for (size_t k = 1; k <= N; ++k)
+			e.c[k] = derivative_term(a, e, k);
+		return e;
+	}
+	friend taylor log(const taylor& a)
+	{
+		using std::log;
+		return logarithm(a, log(a.c[0]), T(1));
+	}
+	friend taylor log10(const taylor& a)
+	{
+		using std::log10;
+		return logarithm(a, log10(a.c[0]), T(std::numbers::ln10));
+	}
+	friend taylor log2(const taylor& a)
+	{
+		using std::log2;
+		return logarithm(a, log2(a.c[0]), T(std::numbers::ln2));
+	}
+	friend taylor trunc(const taylor& a)
+	{
+		using std::trunc;
+		return taylor(trunc(a.c[0]));
+	}
+	friend taylor fmod(const taylor& a, const taylor& b)
+	{
+		using std::fmod, std::trunc;
+		const T n = trunc(a.c[0] / b.c[0]);
+		taylor r;
+		r.c[0] = fmod(a.c[0], b.c[0]);
+		for (size_t k = 1; k <= N; ++k)
+			r.c[k] = a.c[k] - n * b.c[k];
+		return r;
+	}
+	//A constant exponent takes the real power recurrence, which unlike
+	//exp(b*ln(a)) also works for a negative base
+	friend taylor pow(const taylor& a, const taylor& b)
+	{
+		using std::pow;
+		const T value = pow(a.c[0], b.c[0]);
+		if (b.is_constant())
+			return a.is_constant() ? taylor(value) : real_power(a, b.c[0], value);
+		taylor r = exp(b * log(a));
+		r.c[0] = value;
+		return r;
+	}
+	friend taylor math_divide_integer(const taylor& a, const taylor& b)
+	{
+		return taylor(math_divide_integer(a.c[0], b.c[0]));
+	}
+
+private:
+	//(1/k) sum j a[j] g[k-j], the k-th coefficient of f when f' = g a'
+	static T derivative_term(const taylor& a, const taylor& g, size_t k)
+	{
+		T sum = T(0);
+		for (size_t j = 1; j <= k; ++j)
+			sum = sum + T(double(j)) * a.c[j] * g.c[k - j];
+		return sum / T(double(k));
+	}
+	static void sin_cos(const taylor& a, taylor& s, taylor& c)
+	{
+		using std::sin, std::cos;
+		s.c[0] = sin(a.c[0]);
+		c.c[0] = cos(a.c[0]);
+		for (size_t k = 1; k <= N; ++k)
+		{
+			s.c[k] = derivative_term(a, c, k);
+			c.c[k] = -derivative_term(a, s, k);
+		}
+	}
+	//l' = a' / a, scaled by 1/ln(base)
+	static taylor logarithm(const taylor& a, T value, T scale)
+	{
+		taylor l;
+		for (size_t k = 1; k <= N; ++k)
+		{
+			T sum = a.c[k] * T(double(k));
+			for (size_t j = 1; j < k; ++j)
+				sum = sum - T(double(j)) * l.c[j] * a.c[k - j];
+			l.c[k] = sum / (T(double(k)) * a.c[0]);
+		}
+		for (size_t k = 1; k <= N; ++k)
+			l.c[k] = l.c[k] / scale;
+		l.c[0] = value;
+		return l;
+	}
+	//p = a^r from a p' = r p a'
+	static taylor real_power(const taylor& a, T r, T value)
+	{
+		taylor p;
+		p.c[0] = value;
+		for (size_t k = 1; k <= N; ++k)
+		{
+			T sum = T(0);
+			for (size_t j = 1; j <= k; ++j)
+				sum = sum + ((r + 1) * T(double(j)) - T(double(k))) * a.c[j] * p.c[k - j];
+			p.c[k] = sum / (T(double(k)) * a.c[0]);
+		}
+		return p;
+	}
+};
+
+//The expression tree in T, for the programs that do not fit the register file
+template<class T>
+T evaluate(const expression_node& node, T x)
+{
+	switch (node.type)
+	{
+	case node_type::literal:
+		return T(node.value);
+	case node_type::variable:
+		return x;
+	case node_type::negation:
+		return -evaluate(*node.lhs, x);
+	case node_type::function:
+		break;
+	case node_type::binary:
+		const T a = evaluate(*node.lhs, x), b = evaluate(*node.rhs, x);
+		switch (get_opcode(node.op))
+		{
+		case opcode::plus: return a + b;
+		case opcode::minus: return a - b;
+		case opcode::multiply: return a * b;
+		case opcode::divide: return a / b;
+		case opcode::divide_integer: return math_divide_integer(a, b);
+		case opcode::remainder: return math_remainder(a, b);
+		case opcode::power: return math_power(a, b);
+		default: return T(NAN);
+		}
+	}
+
+	const T a = evaluate(*node.lhs, x);
+	switch (get_opcode(node.function))
+	{
+	case opcode::sin: return math_function<accuracy::exact, opcode::sin>(a);
+	case opcode::cos: return math_function<accuracy::exact, opcode::cos>(a);
+	case opcode::tan: return math_function<accuracy::exact, opcode::tan>(a);
+	case opcode::ctg: return math_function<accuracy::exact, opcode::ctg>(a);
+	case opcode::sqrt: return math_function<accuracy::exact, opcode::sqrt>(a);
+	case opcode::cbrt: return math_function<accuracy::exact, opcode::cbrt>(a);
+	case opcode::sqr: return math_function<accuracy::exact, opcode::sqr>(a);
+	case opcode::abs: return math_function<accuracy::exact, opcode::abs>(a);
+	case opcode::exp: return math_function<accuracy::exact, opcode::exp>(a);
+	case opcode::ln: return math_function<accuracy::exact, opcode::ln>(a);
+	case opcode::lg: return math_function<accuracy::exact, opcode::lg>(a);
+	case opcode::log2: return math_function<accuracy::exact, opcode::log2>(a);
+	default: return T(NAN);
+	}
+}
+
+
+struct register_instruction
+{
+	opcode op;
+	uint8_t dst, a, b, c;
+};
+
+struct register_program
+{
+	std::vector<register_instruction> code;
+	std::vector<double> constants;
+	size_t register_count = 0;
+};
+
+constexpr size_t register_file_size = 256;
+
+class register_allocator
+{
+	std::vector<double>& m_constants;
+	std::vector<uint8_t> m_free;
+	size_t m_first_temporary;
+	size_t m_count;
+
+public:
+	register_allocator(std::vector<double>& constants, size_t first_temporary)
+		: m_constants(constants), m_first_temporary(first_temporary), m_count(first_temporary)
+	{
+	}
+
+	size_t count() const noexcept { return this->m_count; }
+
+	uint8_t constant(double value)
+	{
+		for (size_t i = 0; i < this->m_constants.size(); ++i)
+			if (std::bit_cast<uint64_t>(this->m_constants[i]) == std::bit_cast<uint64_t>(value))
+				return uint8_t(1 + i);
+		this->m_constants.push_back(value);
+		return uint8_t(this->m_constants.size());
+	}
+	uint8_t allocate()
+	{
+		if (this->m_free.empty())
+			return uint8_t(this->m_count++);
+		const uint8_t result = this->m_free.back();
+		this->m_free.pop_back();
+		return result;
+	}
+	void release(uint8_t reg)
+	{
+		if (reg >= this->m_first_temporary)
+			this->m_free.push_back(reg);
+	}
+};
+
+struct register_context
+{
+	const expression_dag& dag;
+	std::vector<register_instruction>& code;
+	register_allocator& regs;
+	std::vector<int> reg_of;
+	std::vector<uint32_t> remaining_uses;
+};
+
+bool is_product(const dag_node& node)
+{
+	return node.type == node_type::binary && node.op == op_multiply;
+}
+
+uint8_t emit_registers(register_context& cntxt, uint32_t index)
+{
+	if (cntxt.reg_of[index] >= 0)
+		return uint8_t(cntxt.reg_of[index]);
+
+	const dag_node& node = cntxt.dag.nodes[index];
+	auto emit = [&](opcode op, std::initializer_list<uint32_t> args) -> uint8_t
+	{
+		uint8_t operands[3]{};
+		size_t n = 0;
+		for (auto&& arg : args)
+			operands[n++] = emit_registers(cntxt, arg);
+		n = 0;
+		for (auto&& arg : args)
+		{
+			if (--cntxt.remaining_uses[arg] == 0)
+				cntxt.regs.release(operands[n]);
+			++n;
+		}
+
+		const uint8_t dst = cntxt.regs.allocate();
+		cntxt.code.push_back({ op, dst, operands[0], operands[1], operands[2] });
+		cntxt.reg_of[index] = dst;
+		return dst;
+	};
+
+	switch (node.type)
+	{
+	case node_type::literal:
+		return cntxt.regs.constant(node.value);
+	case node_type::variable:
+		return 0;
+	case node_type::negation:
+		return emit(opcode::negate, { node.lhs });
+	case node_type::function:
+		return emit(get_opcode(node.function), { node.lhs });
+	case node_type::binary:
+		break;
+	}
+
+	const dag_node& lhs = cntxt.dag.nodes[node.lhs];
+	const dag_node& rhs = cntxt.dag.nodes[node.rhs];
+	const bool fuse_lhs = is_product(lhs) && cntxt.dag.uses[node.lhs] == 1;
+	const bool fuse_rhs = is_product(rhs) && cntxt.dag.uses[node.rhs] == 1;
+	const opcode op = get_opcode(node.op);
+
+	if (op == opcode::plus && fuse_lhs)
+		return emit(opcode::mul_add, { lhs.lhs, lhs.rhs, node.rhs });
+	if (op == opcode::plus && fuse_rhs)
+		return emit(opcode::mul_add, { rhs.lhs, rhs.rhs, node.lhs });
+	if (op == opcode::minus && fuse_lhs)
+		return emit(opcode::mul_sub, { lhs.lhs, lhs.rhs, node.rhs });
+	if (op == opcode::minus && fuse_rhs)
+		return emit(opcode::neg_mul_add, { rhs.lhs, rhs.rhs, node.lhs });
+
+	if (op == opcode::multiply && node.lhs == node.rhs)
+		return emit(opcode::sqr, { node.lhs, node.rhs });
+
+	return emit(op, { node.lhs, node.rhs });
+}
+
+std::unique_ptr<register_program> compile_registers(const expression_dag& dag)
+{
+	auto program = std::make_unique<register_program>();
+
+	register_allocator counter(program->constants, 1);
+	for (auto&& node : dag.nodes)
+		if (node.type == node_type::literal)
+			counter.constant(node.value);
+	if (1 + program->constants.size() > register_file_size)
+		return nullptr;
+
+	register_allocator regs(program->constants, 1 + program->constants.size());
+	register_context cntxt{ dag, program->code, regs, {}, {} };
+	cntxt.reg_of.assign(dag.nodes.size(), -1);
+	cntxt.remaining_uses = dag.uses;
+
+	const uint8_t result = emit_registers(cntxt, dag.root);
+	program->code.push_back({ opcode::ret, 0, result, 0, 0 });
+
+	if (regs.count() > register_file_size)
+		return nullptr;
+	program->register_count = regs.count();
+	return program;
+}
+
+template<accuracy A = accuracy::exact, class T = double>
+T run_registers(const register_program& program, T x)
+{
+	T r[register_file_size];
+	r[0] = x;
+	std::copy(program.constants.begin(), program.constants.end(), r + 1);
+
+	for (const register_instruction* pc = program.code.data(); ; ++pc)
+	{
+		switch (pc->op)
+		{
+		case opcode::negate: r[pc->dst] = -r[pc->a]; break;
+
+		case opcode::plus: r[pc->dst] = r[pc->a] + r[pc->b]; break;
+		case opcode::minus: r[pc->dst] = r[pc->a] - r[pc->b]; break;
+		case opcode::multiply: r[pc->dst] = r[pc->a] * r[pc->b]; break;
+		case opcode::divide: r[pc->dst] = r[pc->a] / r[pc->b]; break;
+		case opcode::divide_integer: r[pc->dst] = math_divide_integer(r[pc->a], r[pc->b]); break;
+		case opcode::remainder: r[pc->dst] = math_remainder(r[pc->a], r[pc->b]); break;
+		case opcode::power: r[pc->dst] = math_power(r[pc->a], r[pc->b]); break;
+
+		case opcode::sin: r[pc->dst] = math_function<A, opcode::sin>(r[pc->a]); break;
+		case opcode::cos: r[pc->dst] = math_function<A, opcode::cos>(r[pc->a]); break;
+		case opcode::tan: r[pc->dst] = math_function<A, opcode::tan>(r[pc->a]); break;
+		case opcode::ctg: r[pc->dst] = math_function<A, opcode::ctg>(r[pc->a]); break;
+		case opcode::sqrt: r[pc->dst] = math_function<A, opcode::sqrt>(r[pc->a]); break;
+		case opcode::cbrt: r[pc->dst] = math_function<A, opcode::cbrt>(r[pc->a]); break;
+		case opcode::sqr: r[pc->dst] = math_function<A, opcode::sqr>(r[pc->a]); break;
+		case opcode::abs: r[pc->dst] = math_function<A, opcode::abs>(r[pc->a]); break;
+		case opcode::exp: r[pc->dst] = math_function<A, opcode::exp>(r[pc->a]); break;
+		case opcode::ln: r[pc->dst] = math_function<A, opcode::ln>(r[pc->a]); break;
+		case opcode::lg: r[pc->dst] = math_function<A, opcode::lg>(r[pc->a]); break;
+		case opcode::log2: r[pc->dst] = math_function<A, opcode::log2>(r[pc->a]); break;
+
+		case opcode::mul_add: r[pc->dst] = r[pc->a] * r[pc->b] + r[pc->c]; break;
+		case opcode::mul_sub: r[pc->dst] = r[pc->a] * r[pc->b] - r[pc->c]; break;
+		case opcode::neg_mul_add: r[pc->dst] = r[pc->c] - r[pc->a] * r[pc->b]; break;
+
+		case opcode::push_const:
+		case opcode::push_x:
+		case opcode::load:
+		case opcode::store:
+			return T(NAN);
+
+		case opcode::ret: return r[pc->a];
+		}
+	}
+}
+
+
+//Arguments per block: float blocks hold twice as many in the same memory
+template<class T>
+constexpr size_t batch_block_size = 128 / sizeof(T);
+
+//T is double or float; float registers still call the double functions.
+template<accuracy A = accuracy::exact, class T = double>
+void run_registers_batch(const register_program& program, const T* xs, T* out, size_t n)
+{
+	constexpr size_t B = batch_block_size<T>;
+	T r[register_file_size][B];
+
+	for (size_t i = 0; i < program.constants.size(); ++i)
+		std::fill_n(r[1 + i], B, T(program.constants[i]));
+
+	for (size_t base = 0; base < n; base += B)
+	{
+		const size_t count = std::min(B, n - base);
+		std::copy_n(xs + base, count, r[0]);
+		std::fill(r[0] + count, r[0] + B, T(0));
+
+		for (const register_instruction* pc = program.code.data(); ; ++pc)
+		{
+			T* d = r[pc->dst];
+			const T* a = r[pc->a];
+			const T* b = r[pc->b];
+			const T* c = r[pc->c];
+
+			switch (pc->op)
+			{
+			case opcode::negate: for (size_t i = 0; i < B; ++i) d[i] = -a[i]; continue;
+
+			case opcode::plus: for (size_t i = 0; i < B; ++i) d[i] = a[i] + b[i]; continue;
+			case opcode::minus: for (size_t i = 0; i < B; ++i) d[i] = a[i] - b[i]; continue;
+			case opcode::multiply: for (size_t i = 0; i < B; ++i) d[i] = a[i] * b[i]; continue;
+			case opcode::divide: for (size_t i = 0; i < B; ++i) d[i] = a[i] / b[i]; continue;
+			case opcode::divide_integer: for (size_t i = 0; i < B; ++i) d[i] = op_divide_integer(a[i], b[i]); continue;
+			case opcode::remainder: for (size_t i = 0; i < B; ++i) d[i] = fmod(a[i], b[i]); continue;
+			case opcode::power: for (size_t i = 0; i < B; ++i) d[i] = pow(a[i], b[i]); continue;
+
+			case opcode::sin: for (size_t i = 0; i < B; ++i) d[i] = math_sin<A>(a[i]); continue;
+			case opcode::cos: for (size_t i = 0; i < B; ++i) d[i] = math_cos<A>(a[i]); continue;
+			case opcode::tan: for (size_t i = 0; i < B; ++i) d[i] = math_tan<A>(a[i]); continue;
+			case opcode::ctg: for (size_t i = 0; i < B; ++i) d[i] = math_ctg<A>(a[i]); continue;
+			case opcode::sqrt: for (size_t i = 0; i < B; ++i) d[i] = sqrt(a[i]); continue;
+			case opcode::cbrt: for (size_t i = 0; i < B; ++i) d[i] = math_cbrt<A>(a[i]); continue;
+			case opcode::sqr: for (size_t i = 0; i < B; ++i) d[i] = a[i] * a[i]; continue;
+			case opcode::abs: for (size_t i = 0; i < B; ++i) d[i] = fabs(a[i]); continue;
+			case opcode::exp: for (size_t i = 0; i < B; ++i) d[i] = math_exp<A>(a[i]); continue;
+			case opcode::ln: for (size_t i = 0; i < B; ++i) d[i] = math_ln<A>(a[i]); continue;
+			case opcode::lg: for (size_t i = 0; i < B; ++i) d[i] = math_lg<A>(a[i]); continue;
+			case opcode::log2: for (size_t i = 0; i < B; ++i) d[i] = math_log2<A>(a[i]); continue;
+
+			case opcode::mul_add: for (size_t i = 0; i < B; ++i) d[i] = a[i] * b[i] + c[i]; continue;
+			case opcode::mul_sub: for (size_t i = 0; i < B; ++i) d[i] = a[i] * b[i] - c[i]; continue;
+			case opcode::neg_mul_add: for (size_t i = 0; i < B; ++i) d[i] = c[i] - a[i] * b[i]; continue;
+
+			case opcode::ret:
+				std::copy_n(a, count, out + base);
+				break;
+
+			case opcode::push_const:
+			case opcode::push_x:
+			case opcode::load:
+			case opcode::store:
+				std::fill_n(out + base, count, T(NAN));
+				break;
+			}
+			break;
+		}
+	}
+}
+
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define HAS_X64_SIMD 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define HAS_X64_SIMD 0
+#endif
+
+//Only for speed: inlining the math into the kernel loops pays off, but the
+//kernels are correct without it
+#if defined(__GNUC__)
+#define FLATTEN __attribute__((flatten))
+#else
+#define FLATTEN
+#endif
+
+enum class simd_level
+{
+	none,
+	sse2,
+	avx2,
+	avx512,
+};
+
+simd_level detect_simd_level()
+{
+#if !HAS_X64_SIMD
+	return simd_level::none;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	const int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	const bool osxsave = info[2] & (1 << 27);
+	const bool avx = info[2] & (1 << 28);
+	if (!osxsave || !avx || max_leaf < 7)
+		return simd_level::sse2;
+
+	const unsigned long long xcr0 = _xgetbv(0);
+	__cpuidex(info, 7, 0);
+	const bool avx2 = info[1] & (1 << 5);
+	const bool avx512f = info[1] & (1 << 16);
+
+	if (avx512f && (xcr0 & 0xE6) == 0xE6)
+		return simd_level::avx512;
+	if (avx2 && (xcr0 & 0x6) == 0x6)
+		return simd_level::avx2;
+	return simd_level::sse2;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f"))
+		return simd_level::avx512;
+	if (__builtin_cpu_supports("avx2"))
+		return simd_level::avx2;
+	return simd_level::sse2;
+#endif
+}
+
+#if HAS_X64_SIMD
+
+struct simd_sse2
+{
+	using reg = __m128d;
+	using scalar = double;
+	using wide = simd_sse2;
+	static constexpr size_t width = 2;
+	static constexpr bool has_trunc = false;
+
+	static reg load(const double* p) { return _mm_loadu_pd(p); }
+	static void store(double* p, reg x) { _mm_storeu_pd(p, x); }
+	static reg set1(double x) { return _mm_set1_pd(x); }
+	static reg add(reg a, reg b) { return _mm_add_pd(a, b); }
+	static reg sub(reg a, reg b) { return _mm_sub_pd(a, b); }
+	static reg mul(reg a, reg b) { return _mm_mul_pd(a, b); }
+	static reg div(reg a, reg b) { return _mm_div_pd(a, b); }
+	static reg sqrt(reg a) { return _mm_sqrt_pd(a); }
+	static reg neg(reg a) { return _mm_xor_pd(a, _mm_set1_pd(-0.0)); }
+	static reg abs(reg a) { return _mm_andnot_pd(_mm_set1_pd(-0.0), a); }
+	static reg trunc(reg a) { return a; }
+
+	using mask = __m128d;
+	static reg min(reg a, reg b) { return _mm_min_pd(a, b); }
+	static reg max(reg a, reg b) { return _mm_max_pd(a, b); }
+	static mask lt(reg a, reg b) { return _mm_cmplt_pd(a, b); }
+	static mask eq(reg a, reg b) { return _mm_cmpeq_pd(a, b); }
+	static mask is_nan(reg a) { return _mm_cmpunord_pd(a, a); }
+	static mask mask_or(mask a, mask b) { return _mm_or_pd(a, b); }
+	static bool any(mask m) { return _mm_movemask_pd(m) != 0; }
+	static reg select(mask m, reg a, reg b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+
+	using ireg = __m128i;
+	static ireg bits(reg a) { return _mm_castpd_si128(a); }
+	static reg from_bits(ireg a) { return _mm_castsi128_pd(a); }
+	static ireg iset1(int64_t x) { return _mm_set1_epi64x(x); }
+	static ireg iand(ireg a, ireg b) { return _mm_and_si128(a, b); }
+	static ireg ior(ireg a, ireg b) { return _mm_or_si128(a, b); }
+	static ireg ixor(ireg a, ireg b) { return _mm_xor_si128(a, b); }
+	static ireg iadd(ireg a, ireg b) { return _mm_add_epi64(a, b); }
+	static ireg shl(ireg a, int n) { return _mm_slli_epi64(a, n); }
+	static ireg shr(ireg a, int n) { return _mm_srli_epi64(a, n); }
+};
+
+//Single-precision lanes only do the arithmetic themselves. The functions
+//run on the double vector type of the same width, one half at a time.
+
+struct simd_sse2_f32
+{
+	using reg = __m128;
+	using scalar = float;
+	using wide = simd_sse2;
+	static constexpr size_t width = 4;
+
+	static reg load(const float* p) { return _mm_loadu_ps(p); }
+	static void store(float* p, reg x) { _mm_storeu_ps(p, x); }
+	static reg set1(float x) { return _mm_set1_ps(x); }
+	static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+	static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+	static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+	static reg div(reg a, reg b) { return _mm_div_ps(a, b); }
+	static reg sqrt(reg a) { return _mm_sqrt_ps(a); }
+	static reg neg(reg a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+	static reg abs(reg a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+
+	static wide::reg widen_low(reg a) { return _mm_cvtps_pd(a); }
+	static wide::reg widen_high(reg a) { return _mm_cvtps_pd(_mm_movehl_ps(a, a)); }
+	static reg narrow(wide::reg low, wide::reg high) { return _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high)); }
+};
+
+template<class T>
+bool simd_trig_in_range(const T* a)
+{
+	for (size_t i = 0; i < batch_block_size<T>; ++i)
+		if (!(fabs(a[i]) <= simd_trig_limit))
+			return false;
+	return true;
+}
+
+#include "simd_batch.h"
+
+template<accuracy A, class T>
+FLATTEN void run_sse2_batch(const register_program& program, const T* xs, T* out, size_t n)
+{
+	run_simd_batch<std::conditional_t<std::is_same_v<T, float>, simd_sse2_f32, simd_sse2>, A>(program, xs, out, n);
+}
+
+//Everything an AVX kernel calls is compiled for its instruction set, so no
+//vector crosses a call compiled for the baseline ABI at any optimization level.
+//The generic code gets its own copy in a namespace per set.
+#if defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+struct simd_avx2
+{
+	using reg = __m256d;
+	using scalar = double;
+	using wide = simd_avx2;
+	static constexpr size_t width = 4;
+	static constexpr bool has_trunc = true;
+
+	static reg load(const double* p) { return _mm256_loadu_pd(p); }
+	static void store(double* p, reg x) { _mm256_storeu_pd(p, x); }
+	static reg set1(double x) { return _mm256_set1_pd(x); }
+	static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+	static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+	static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+	static reg div(reg a, reg b) { return _mm256_div_pd(a, b); }
+	static reg sqrt(reg a) { return _mm256_sqrt_pd(a); }
+	static reg neg(reg a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+	static reg abs(reg a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.0), a); }
+	static reg trunc(reg a) { return _mm256_round_pd(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+
+	using mask = __m256d;
+	static reg min(reg a, reg b) { return _mm256_min_pd(a, b); }
+	static reg max(reg a, reg b) { return _mm256_max_pd(a, b); }
+	static mask lt(reg a, reg b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+	static mask eq(reg a, reg b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+	static mask is_nan(reg a) { return _mm256_cmp_pd(a, a, _CMP_UNORD_Q); }
+	static mask mask_or(mask a, mask b) { return _mm256_or_pd(a, b); }
+	static bool any(mask m) { return _mm256_movemask_pd(m) != 0; }
+	static reg select(mask m, reg a, reg b) { return _mm256_blendv_pd(b, a, m); }
+
+	using ireg = __m256i;
+	static ireg bits(reg a) { return _mm256_castpd_si256(a); }
+	static reg from_bits(ireg a) { return _mm256_castsi256_pd(a); }
+	static ireg iset1(int64_t x) { return _mm256_set1_epi64x(x); }
+	static ireg iand(ireg a, ireg b) { return _mm256_and_si256(a, b); }
+	static ireg ior(ireg a, ireg b) { return _mm256_or_si256(a, b); }
+	static ireg ixor(ireg a, ireg b) { return _mm256_xor_si256(a, b); }
+	static ireg iadd(ireg a, ireg b) { return _mm256_add_epi64(a, b); }
+	static ireg shl(ireg a, int n) { return _mm256_slli_epi64(a, n); }
+	static ireg shr(ireg a, int n) { return _mm256_srli_epi64(a, n); }
+};
+
+struct simd_avx2_f32
+{
+	using reg = __m256;
+	using scalar = float;
+	using wide = simd_avx2;
+	static constexpr size_t width = 8;
+
+	static reg load(const float* p) { return _mm256_loadu_ps(p); }
+	static void store(float* p, reg x) { _mm256_storeu_ps(p, x); }
+	static reg set1(float x) { return _mm256_set1_ps(x); }
+	static reg add(reg a, reg b) { return _mm256_add_ps(a, b); }
+	static reg sub(reg a, reg b) { return _mm256_sub_ps(a, b); }
+	static reg mul(reg a, reg b) { return _mm256_mul_ps(a, b); }
+	static reg div(reg a, reg b) { return _mm256_div_ps(a, b); }
+	static reg sqrt(reg a) { return _mm256_sqrt_ps(a); }
+	static reg neg(reg a) { return _mm256_xor_ps(a, _mm256_set1_ps(-0.0f)); }
+	static reg abs(reg a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+
+	static wide::reg widen_low(reg a) { return _mm256_cvtps_pd(_mm256_castps256_ps128(a)); }
+	static wide::reg widen_high(reg a) { return _mm256_cvtps_pd(_mm256_extractf128_ps(a, 1)); }
+	static reg narrow(wide::reg low, wide::reg high)
+	{
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm256_cvtpd_ps(low)), _mm256_cvtpd_ps(high), 1);
+	}
+};
+
+namespace avx2_kernels
+{
+#include "simd_math.h"
+#include "simd_batch.h"
+}
+
+template<accuracy A, class T>
+FLATTEN void run_avx2_batch(const register_program& program, const T* xs, T* out, size_t n)
+{
+	avx2_kernels::run_simd_batch<std::conditional_t<std::is_same_v<T, float>, simd_avx2_f32, simd_avx2>, A>(program, xs, out, n);
+}
+
+#if defined(__GNUC__)
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+struct simd_avx512
+{
+	using reg = __m512d;
+	using scalar = double;
+	using wide = simd_avx512;
+	static constexpr size_t width = 8;
+	static constexpr bool has_trunc = true;
+
+	static reg load(const double* p) { return _mm512_loadu_pd(p); }
+	static void store(double* p, reg x) { _mm512_storeu_pd(p, x); }
+	static reg set1(double x) { return _mm512_set1_pd(x); }
+	static reg add(reg a, reg b) { return _mm512_add_pd(a, b); }
+	static reg sub(reg a, reg b) { return _mm512_sub_pd(a, b); }
+	//The unmasked forms of several intrinsics pass an uninitialized vector as
+	//their merge source, which GCC warns about once they are inlined. The
+	//zero-masking forms with every lane selected are the same instructions.
+	static constexpr __mmask8 all = 0xFF;
+
+	//Explicit rounding keeps the compiler from contracting mul+add into an FMA,
+	//which AVX-512 implies and which would round differently from the scalar tiers.
+	static reg mul(reg a, reg b) { return _mm512_maskz_mul_round_pd(all, a, b, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	static reg div(reg a, reg b) { return _mm512_div_pd(a, b); }
+	static reg sqrt(reg a) { return _mm512_maskz_sqrt_pd(all, a); }
+	static reg neg(reg a)
+	{
+		const __m512i sign = _mm512_set1_epi64(INT64_MIN);
+		return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(a), sign));
+	}
+	static reg abs(reg a) { return _mm512_abs_pd(a); }
+	static reg trunc(reg a) { return _mm512_maskz_roundscale_pd(all, a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+
+	using mask = __mmask8;
+	static reg min(reg a, reg b) { return _mm512_maskz_min_pd(all, a, b); }
+	static reg max(reg a, reg b) { return _mm512_maskz_max_pd(all, a, b); }
+	static mask lt(reg a, reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+	static mask eq(reg a, reg b) { return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ); }
+	static mask is_nan(reg a) { return _mm512_cmp_pd_mask(a, a, _CMP_UNORD_Q); }
+	static mask mask_or(mask a, mask b) { return mask(a | b); }
+	static bool any(mask m) { return m != 0; }
+	static reg select(mask m, reg a, reg b) { return _mm512_mask_blend_pd(m, b, a); }
+
+	using ireg = __m512i;
+	static ireg bits(reg a) { return _mm512_castpd_si512(a); }
+	static reg from_bits(ireg a) { return _mm512_castsi512_pd(a); }
+	static ireg iset1(int64_t x) { return _mm512_set1_epi64(x); }
+	static ireg iand(ireg a, ireg b) { return _mm512_and_si512(a, b); }
+	static ireg ior(ireg a, ireg b) { return _mm512_or_si512(a, b); }
+	static ireg ixor(ireg a, ireg b) { return _mm512_xor_si512(a, b); }
+	static ireg iadd(ireg a, ireg b) { return _mm512_add_epi64(a, b); }
+	static ireg shl(ireg a, int n) { return _mm512_maskz_slli_epi64(all, a, n); }
+	static ireg shr(ireg a, int n) { return _mm512_maskz_srli_epi64(all, a, n); }
+};
+
+struct simd_avx512_f32
+{
+	using reg = __m512;
+	using scalar = float;
+	using wide = simd_avx512;
+	static constexpr size_t width = 16;
+
+	static reg load(const float* p) { return _mm512_loadu_ps(p); }
+	static void store(float* p, reg x) { _mm512_storeu_ps(p, x); }
+	static reg set1(float x) { return _mm512_set1_ps(x); }
+	static reg add(reg a, reg b) { return _mm512_add_ps(a, b); }
+	static reg sub(reg a, reg b) { return _mm512_sub_ps(a, b); }
+	//Zero-masking forms and no FMA contraction, as in simd_avx512
+	static constexpr __mmask16 all = 0xFFFF;
+	static reg mul(reg a, reg b) { return _mm512_maskz_mul_round_ps(all, a, b, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+	static reg div(reg a, reg b) { return _mm512_div_ps(a, b); }
+	static reg sqrt(reg a) { return _mm512_maskz_sqrt_ps(all, a); }
+	static reg neg(reg a)
+	{
+		const __m512i sign = _mm512_set1_epi32(INT32_MIN);
+		return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(a), sign));
+	}
+	static reg abs(reg a) { return _mm512_abs_ps(a); }
+
+	//GCC casts to the low half through an unmasked extract
+	static wide::reg widen_low(reg a)
+	{
+		const __m256d low = _mm512_maskz_extractf64x4_pd(0xF, _mm512_castps_pd(a), 0);
+		return _mm512_maskz_cvtps_pd(wide::all, _mm256_castpd_ps(low));
+	}
+	static wide::reg widen_high(reg a)
+	{
+		const __m256d high = _mm512_maskz_extractf64x4_pd(0xF, _mm512_castps_pd(a), 1);
+		return _mm512_maskz_cvtps_pd(wide::all, _mm256_castpd_ps(high));
+	}
+	static reg narrow(wide::reg low, wide::reg high)
+	{
+		const __m512d packed = _mm512_castps_pd(_mm512_castps256_ps512(_mm512_maskz_cvtpd_ps(wide::all, low)));
+		return _mm512_castpd_ps(_mm512_maskz_insertf64x4(wide::all, packed, _mm256_castps_pd(_mm512_maskz_cvtpd_ps(wide::all, high)), 1));
+	}
+};
+
+namespace avx512_kernels
+{
+#include "simd_math.h"
+#include "simd_batch.h"
+}
+
+template<accuracy A, class T>
+FLATTEN void run_avx512_batch(const register_program& program, const T* xs, T* out, size_t n)
+{
+	avx512_kernels::run_simd_batch<std::conditional_t<std::is_same_v<T, float>, simd_avx512_f32, simd_avx512>, A>(program, xs, out, n);
+}
+
+#if defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
+
+template<class T>
+using batch_kernel_of = void(*)(const register_program& program, const T* xs, T* out, size_t n);
+using batch_kernel = batch_kernel_of<double>;
+
+template<accuracy A, class T = double>
+batch_kernel_of<T> get_batch_kernel(simd_level level)
+{
+#if HAS_X64_SIMD
+	switch (level)
+	{
+	case simd_level::avx512: return &run_avx512_batch<A, T>;
+	case simd_level::avx2: return &run_avx2_batch<A, T>;
+	case simd_level::sse2: return &run_sse2_batch<A, T>;
+	case simd_level::none: break;
+	}
+#endif
+	return &run_registers_batch<A, T>;
+}
+batch_kernel get_batch_kernel(simd_level level, accuracy policy)
+{
+	switch (policy)
+	{
+	case accuracy::faithful: return get_batch_kernel<accuracy::faithful>(level);
+	case accuracy::fast: return get_batch_kernel<accuracy::fast>(level);
+	case accuracy::exact: break;
+	}
+	return get_batch_kernel<accuracy::exact>(level);
+}
+batch_kernel get_batch_kernel(accuracy policy)
+{
+	static const simd_level level = detect_simd_level();
+	return get_batch_kernel(level, policy);
+}
+batch_kernel_of<float> get_float_batch_kernel(simd_level level)
+{
+	return get_batch_kernel<accuracy::fast, float>(level);
+}
+batch_kernel_of<float> get_float_batch_kernel()
+{
+	static const simd_level level = detect_simd_level();
+	return get_float_batch_kernel(level);
+}
+
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define HAS_X64_JIT 1
+#else
+#define HAS_X64_JIT 0
+#endif
+
+#if HAS_X64_JIT
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#endif
+
+using native_function = double(*)(double);
+
+class native_code
+{
+	void* m_memory = nullptr;
+	size_t m_size = 0;
+
+public:
+	native_code() noexcept = default;
+	native_code(const std::vector<uint8_t>& image);
+	native_code(native_code&& other) noexcept;
+	native_code& operator=(native_code&& other) noexcept;
+	~native_code();
+
+	explicit operator bool() const noexcept { return this->m_memory != nullptr; }
+	native_function entry() const noexcept { return (native_function)this->m_memory; }
+};
+
+#if HAS_X64_JIT
+
+native_code::native_code(const std::vector<uint8_t>& image)
+{
+#ifdef _WIN32
+	void* memory = VirtualAlloc(nullptr, image.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if (memory == nullptr)
+		return;
+	memcpy(memory, image.data(), image.size());
+	DWORD old_protection;
+	if (!VirtualProtect(memory, image.size(), PAGE_EXECUTE_READ, &old_protection))
+	{
+		VirtualFree(memory, 0, MEM_RELEASE);
+		return;
+	}
+	FlushInstructionCache(GetCurrentProcess(), memory, image.size());
+#else
+	void* memory = mmap(nullptr, image.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+		return;
+	memcpy(memory, image.data(), image.size());
+	if (mprotect(memory, image.size(), PROT_READ | PROT_EXEC) != 0)
+	{
+		munmap(memory, image.size());
+		return;
+	}
+#endif
+	this->m_memory = memory;
+	this->m_size = image.size();
+}
+native_code::~native_code()
+{
+	if (this->m_memory == nullptr)
+		return;
+#ifdef _WIN32
+	VirtualFree(this->m_memory, 0, MEM_RELEASE);
+#else
+	munmap(this->m_memory, this->m_size);
+#endif
+}
+
+#else
+
+native_code::native_code(const std::vector<uint8_t>&)
+{
+}
+native_code::~native_code()
+{
+}
+
+#endif
+
+native_code::native_code(native_code&& other) noexcept
+	: m_memory(std::exchange(other.m_memory, nullptr)), m_size(std::exchange(other.m_size, 0))
+{
+}
+native_code& native_code::operator=(native_code&& other) noexcept
+{
+	native_code tmp(std::move(other));
+	std::swap(this->m_memory, tmp.m_memory);
+	std::swap(this->m_size, tmp.m_size);
+	return *this;
+}
+
+
+class x64_emitter
+{
+	struct fixup
+	{
+		size_t position;
+		size_t constant;
+	};
+
+	std::vector<uint8_t> m_code;
+	std::vector<fixup> m_fixups;
+	std::vector<double> m_constants;
+	int32_t m_slots_base = 0;
+
+	void byte(uint8_t b) { this->m_code.push_back(b); }
+	template<class T>
+	void immediate(T value)
+	{
+		uint8_t bytes[sizeof(T)];
+		memcpy(bytes, &value, sizeof(T));
+		this->m_code.insert(this->m_code.end(), bytes, bytes + sizeof(T));
+	}
+
+public:
+	enum xmm : uint8_t { xmm0, xmm1 };
+
+	struct location
+	{
+		bool is_constant;
+		size_t index;
+	};
+
+	location slot(size_t index) const { return { false, index }; }
+	location constant(double value)
+	{
+		this->m_constants.push_back(value);
+		return { true, this->m_constants.size() - 1 };
+	}
+
+	void set_slots_base(int32_t base) { this->m_slots_base = base; }
+
+	void modrm(uint8_t reg, location loc)
+	{
+		if (loc.is_constant)
+		{
+			this->byte(0x05 | reg << 3);
+			this->m_fixups.push_back({ this->m_code.size(), loc.index });
+			this->immediate<int32_t>(0);
+		}
+		else
+		{
+			this->byte(0x84 | reg << 3);
+			this->byte(0x24);
+			this->immediate<int32_t>(this->m_slots_base + int32_t(8 * loc.index));
+		}
+	}
+
+	void sse(uint8_t prefix, uint8_t op, xmm reg, location loc)
+	{
+		this->byte(prefix);
+		this->byte(0x0F);
+		this->byte(op);
+		this->modrm(reg, loc);
+	}
+	void sse(uint8_t prefix, uint8_t op, xmm dst, xmm src)
+	{
+		this->byte(prefix);
+		this->byte(0x0F);
+		this->byte(op);
+		this->byte(0xC0 | dst << 3 | src);
+	}
+
+	void movsd(xmm dst, location src) { this->sse(0xF2, 0x10, dst, src); }
+	void movsd(location dst, xmm src) { this->sse(0xF2, 0x11, src, dst); }
+	void addsd(xmm dst, location src) { this->sse(0xF2, 0x58, dst, src); }
+	void mulsd(xmm dst, location src) { this->sse(0xF2, 0x59, dst, src); }
+	void subsd(xmm dst, location src) { this->sse(0xF2, 0x5C, dst, src); }
+	void divsd(xmm dst, location src) { this->sse(0xF2, 0x5E, dst, src); }
+	void sqrtsd(xmm dst, location src) { this->sse(0xF2, 0x51, dst, src); }
+	void mulsd(xmm dst, xmm src) { this->sse(0xF2, 0x59, dst, src); }
+	void subsd(xmm dst, xmm src) { this->sse(0xF2, 0x5C, dst, src); }
+	void andpd(xmm dst, xmm src) { this->sse(0x66, 0x54, dst, src); }
+	void xorpd(xmm dst, xmm src) { this->sse(0x66, 0x57, dst, src); }
+
+	void sub_rsp(int32_t size)
+	{
+		this->byte(0x48); this->byte(0x81); this->byte(0xEC);
+		this->immediate(size);
+	}
+	void add_rsp(int32_t size)
+	{
+		this->byte(0x48); this->byte(0x81); this->byte(0xC4);
+		this->immediate(size);
+	}
+	void call(const void* target)
+	{
+		this->byte(0x48); this->byte(0xB8);
+		this->immediate((uint64_t)target);
+		this->byte(0xFF); this->byte(0xD0);
+	}
+	void ret() { this->byte(0xC3); }
+
+	std::vector<uint8_t> link()
+	{
+		while (this->m_code.size() % 16)
+			this->byte(0xCC);
+
+		const size_t constants_start = this->m_code.size();
+		for (auto&& value : this->m_constants)
+			this->immediate(value);
+
+		for (auto&& [position, index] : this->m_fixups)
+		{
+			const auto target = int64_t(constants_start + 8 * index);
+			const auto next_instruction = int64_t(position + 4);
+			const auto displacement = int32_t(target - next_instruction);
+			memcpy(this->m_code.data() + position, &displacement, 4);
+		}
+		return std::move(this->m_code);
+	}
+};
+
+const void* get_native_callee(opcode op)
+{
+	switch (op)
+	{
+	case opcode::sin: return (const void*)static_cast<unary_function>(&sin);
+	case opcode::cos: return (const void*)static_cast<unary_function>(&cos);
+	case opcode::tan: return (const void*)static_cast<unary_function>(&tan);
+	case opcode::ctg: return (const void*)&fn_ctg;
+	case opcode::cbrt: return (const void*)static_cast<unary_function>(&cbrt);
+	case opcode::exp: return (const void*)static_cast<unary_function>(&exp);
+	case opcode::ln: return (const void*)static_cast<unary_function>(&log);
+	case opcode::lg: return (const void*)static_cast<unary_function>(&log10);
+	case opcode::log2: return (const void*)static_cast<unary_function>(&log2);
+	case opcode::divide_integer: return (const void*)&op_divide_integer;
+	case opcode::remainder: return (const void*)static_cast<binary_func>(&fmod);
+	case opcode::power: return (const void*)static_cast<binary_func>(&pow);
+	default: return nullptr;
+	}
+}
+
+native_code compile_native(const register_program& program)
+{
+	if (!HAS_X64_JIT)
+		return {};
+
+#ifdef _WIN32
+	const int32_t shadow_space = 32;
+#else
+	const int32_t shadow_space = 0;
+#endif
+	int32_t frame_size = shadow_space + int32_t(8 * program.register_count);
+	frame_size += 8 - frame_size % 16;
+
+	x64_emitter jit;
+	using enum x64_emitter::xmm;
+	jit.set_slots_base(shadow_space);
+
+	const auto sign_mask = jit.constant(std::bit_cast<double>(0x8000000000000000));
+	const auto abs_mask = jit.constant(std::bit_cast<double>(0x7FFFFFFFFFFFFFFF));
+	std::vector<x64_emitter::location> locations(program.register_count, jit.slot(0));
+	for (size_t i = 0; i < program.constants.size(); ++i)
+		locations[1 + i] = jit.constant(program.constants[i]);
+	for (size_t i = 1 + program.constants.size(); i < program.register_count; ++i)
+		locations[i] = jit.slot(i);
+
+	jit.sub_rsp(frame_size);
+	jit.movsd(locations[0], xmm0);
+
+	for (auto&& instruction : program.code)
+	{
+		const auto dst = locations[instruction.dst];
+		const auto a = locations[instruction.a];
+		const auto b = locations[instruction.b];
+		const auto c = locations[instruction.c];
+
+		switch (instruction.op)
+		{
+		case opcode::negate:
+			jit.movsd(xmm0, a);
+			jit.movsd(xmm1, sign_mask);
+			jit.xorpd(xmm0, xmm1);
+			break;
+		case opcode::abs:
+			jit.movsd(xmm0, a);
+			jit.movsd(xmm1, abs_mask);
+			jit.andpd(xmm0, xmm1);
+			break;
+		case opcode::sqr:
+			jit.movsd(xmm0, a);
+			jit.mulsd(xmm0, xmm0);
+			break;
+		case opcode::sqrt:
+			jit.sqrtsd(xmm0, a);
+			break;
+
+		case opcode::plus: jit.movsd(xmm0, a); jit.addsd(xmm0, b); break;
+		case opcode::minus: jit.movsd(xmm0, a); jit.subsd(xmm0, b); break;
+		case opcode::multiply: jit.movsd(xmm0, a); jit.mulsd(xmm0, b); break;
+		case opcode::divide: jit.movsd(xmm0, a); jit.divsd(xmm0, b); break;
+
+		case opcode::mul_add: jit.movsd(xmm0, a); jit.mulsd(xmm0, b); jit.addsd(xmm0, c); break;
+		case opcode::mul_sub: jit.movsd(xmm0, a); jit.mulsd(xmm0, b); jit.subsd(xmm0, c); break;
+		case opcode::neg_mul_add:
+			jit.movsd(xmm1, a);
+			jit.mulsd(xmm1, b);
+			jit.movsd(xmm0, c);
+			jit.subsd(xmm0, xmm1);
+			break;
+
+		case opcode::divide_integer:
+		case opcode::remainder:
+		case opcode::power:
+			jit.movsd(xmm0, a);
+			jit.movsd(xmm1, b);
+			jit.call(get_native_callee(instruction.op));
+			break;
+
+		case opcode::ret:
+			jit.movsd(xmm0, a);
+			jit.add_rsp(frame_size);
+			jit.ret();
+			continue;
+
+		case opcode::push_const:
+		case opcode::push_x:
+		case opcode::load:
+		case opcode::store:
+			return {};
+
+		default:
+			jit.movsd(xmm0, a);
+			jit.call(get_native_callee(instruction.op));
+			break;
+		}
+		jit.movsd(dst, xmm0);
+	}
+
+	return native_code(jit.link());
+}
+
+
+struct compiled_formula
+{
+	std::unique_ptr<register_program> program;
+	native_code native;
+};
+
+std::unique_ptr<compiled_formula> compile_formula(const expression_dag& dag)
+{
+	auto compiled = std::make_unique<compiled_formula>();
+	compiled->program = compile_registers(dag);
+	if (!compiled->program)
+		return nullptr;
+	compiled->native = compile_native(*compiled->program);
+	return compiled;
+}
+
+double run_compiled(const compiled_formula& compiled, double x)
+{
+	if (compiled.native)
+		return compiled.native.entry()(x);
+	return run_registers(*compiled.program, x);
+}
+
+//Ahead-of-time compilation: the DAG as a C++ translation unit, built into a
+//shared object by the system compiler and loaded with dlopen. Objects are
+//cached by a hash of their source, so each formula is compiled once per
+//machine. POSIX only; elsewhere formulas keep running on the JIT.
+#include <filesystem>
+#include <fstream>
+#include <cstdlib>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+class native_module
+{
+	void* m_handle = nullptr;
+	native_function m_entry = nullptr;
+
+public:
+	native_module() noexcept = default;
+	native_module(const std::filesystem::path& path, const char* symbol);
+	native_module(native_module&& other) noexcept;
+	native_module& operator=(native_module&& other) noexcept;
+	~native_module();
+
+	explicit operator bool() const noexcept { return this->m_entry != nullptr; }
+	native_function entry() const noexcept { return this->m_entry; }
+};
+
+#ifndef _WIN32
+
+native_module::native_module(const std::filesystem::path& path, const char* symbol)
+{
+	void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (handle == nullptr)
+		return;
+	auto entry = (native_function)dlsym(handle, symbol);
+	if (entry == nullptr)
+	{
+		dlclose(handle);
+		return;
+	}
+	this->m_handle = handle;
+	this->m_entry = entry;
+}
+native_module::~native_module()
+{
+	if (this->m_handle != nullptr)
+		dlclose(this->m_handle);
+}
+
+#else
+
+native_module::native_module(const std::filesystem::path&, const char*)
+{
+}
+native_module::~native_module()
+{
+}
+
+#endif
+
+native_module::native_module(native_module&& other) noexcept
+	: m_handle(std::exchange(other.m_handle, nullptr)), m_entry(std::exchange(other.m_entry, nullptr))
+{
+}
+native_module& native_module::operator=(native_module&& other) noexcept
+{
+	native_module tmp(std::move(other));
+	std::swap(this->m_handle, tmp.m_handle);
+	std::swap(this->m_entry, tmp.m_entry);
+	return *this;
+}
+
+constexpr const char* ahead_of_time_symbol = "uni_formula";
+//ISO mode keeps the compiler from contracting products and sums into FMAs,
+//so results stay the same as on every other path
+constexpr const char* ahead_of_time_flags = "-std=c++20 -O3 -march=native -ffp-contract=off -fPIC -shared";
+
+//One statement per DAG node, children first, in the same operations as run_registers
+std::string generate_cpp_source(const expression_dag& dag)
+{
+	std::string source = std::format("#include <bit>\n#include <cfloat>\n#include <cmath>\n#include <cstdint>\n\nextern \"C\" double {}(double x)\n{{\n", ahead_of_time_symbol);
+	for (uint32_t i = 0; i <= dag.root; ++i)
+	{
+		const dag_node& node = dag.nodes[i];
+		const std::string a = std::format("v{}", node.lhs), b = std::format("v{}", node.rhs);
+		std::string value;
+		switch (node.type)
+		{
+		case node_type::literal:
+			value = std::format("std::bit_cast<double>(UINT64_C({:#x}))", std::bit_cast<uint64_t>(node.value));
+			break;
+		case node_type::variable:
+			value = "x";
+			break;
+		case node_type::negation:
+			value = "-" + a;
+			break;
+		case node_type::function:
+			switch (get_opcode(node.function))
+			{
+			case opcode::ctg: value = std::format("1 / std::tan({})", a); break;
+			case opcode::sqr: value = std::format("{} * {}", a, a); break;
+			case opcode::abs: value = std::format("std::fabs({})", a); break;
+			case opcode::ln: value = std::format("std::log({})", a); break;
+			case opcode::lg: value = std::format("std::log10({})", a); break;
+			case opcode::sin: value = std::format("std::sin({})", a); break;
+			case opcode::cos: value = std::format("std::cos({})", a); break;
+			case opcode::tan: value = std::format("std::tan({})", a); break;
+			case opcode::sqrt: value = std::format("std::sqrt({})", a); break;
+			case opcode::cbrt: value = std::format("std::cbrt({})", a); break;
+			case opcode::exp: value = std::format("std::exp({})", a); break;
+			case opcode::log2: value = std::format("std::log2({})", a); break;
+			default: return {};
+			}
+			break;
+		case node_type::binary:
+			switch (get_opcode(node.op))
+			{
+			case opcode::plus: value = std::format("{} + {}", a, b); break;
+			case opcode::minus: value = std::format("{} - {}", a, b); break;
+			case opcode::multiply: value = std::format("{} * {}", a, b); break;
+			case opcode::divide: value = std::format("{} / {}", a, b); break;
+			case opcode::divide_integer: value = std::format("std::trunc({} / {} * (1 + 2 * DBL_EPSILON))", a, b); break;
+			case opcode::remainder: value = std::format("std::fmod({}, {})", a, b); break;
+			case opcode::power: value = std::format("std::pow({}, {})", a, b); break;
+			default: return {};
+			}
+			break;
+		}
+		source += std::format("\tconst double v{} = {};\n", i, value);
+	}
+	source += std::format("\treturn v{};\n}}\n", dag.root);
+	return source;
+}
+
+//FNV-1a, which unlike std::hash is the same in every build
+uint64_t stable_hash(std::string_view str)
+{
+	uint64_t hash = 0xCBF29CE484222325;
+	for (char c : str)
+	{
+		hash ^= uint8_t(c);
+		hash *= 0x100000001B3;
+	}
+	return hash;
+}
+
+//Empty without a per-user cache: a shared fallback such as /tmp would let
+//another user plant an object there for us to load
+std::filesystem::path ahead_of_time_cache_directory()
+{
+	if (const char* dir = std::getenv("XDG_CACHE_HOME"); dir && *dir)
+		return std::filesystem::path(dir) / "uni_equation_solver";
+	if (const char* dir = std::getenv("HOME"); dir && *dir)
+		return std::filesystem::path(dir) / ".cache" / "uni_equation_solver";
+	return {};
+}
+
+#ifndef _WIN32
+//Owned by us, writable by nobody else, and not a symlink
+bool is_private(const std::filesystem::path& path, bool directory)
+{
+	struct stat info;
+	if (lstat(path.c_str(), &info) != 0)
+		return false;
+	if (directory ? !S_ISDIR(info.st_mode) : !S_ISREG(info.st_mode))
+		return false;
+	return info.st_uid == geteuid() && (info.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+#endif
+
+std::string shell_quote(std::string_view str)
+{
+	std::string result = "'";
+	for (char c : str)
+		result += c == '\'' ? std::string("'\\''") : std::string(1, c);
+	return result + "'";
+}
+
+//$CXX, then g++, then clang++. The object is built under a temporary name
+//and renamed into place, so concurrent runs never load a partial file.
+//Nothing is loaded from a directory or file that another user could write.
+native_module load_ahead_of_time(const expression_dag& dag)
+{
+#ifdef _WIN32
+	(void)dag;
+	return {};
+#else
+	const std::string source = generate_cpp_source(dag);
+	if (source.empty())
+		return {};
+
+	//-march=native code is only valid on the kind of machine that built it
+	const uint64_t hash = stable_hash(std::format("{}\n{}\n{}", source, ahead_of_time_flags, int(detect_simd_level())));
+	const std::filesystem::path dir = ahead_of_time_cache_directory();
+	if (dir.empty())
+		return {};
+	const std::filesystem::path object = dir / std::format("{:016x}.so", hash);
+
+	std::error_code ec;
+	std::filesystem::create_directories(dir.parent_path(), ec);
+	mkdir(dir.c_str(), 0700);
+	if (!is_private(dir, true))
+		return {};
+
+	if (is_private(object, false))
+	{
+		if (native_module module(object, ahead_of_time_symbol); module)
+			return module;
+	}
+
+	const std::string temporary = std::format("{:016x}.{}", hash, getpid());
+	const std::filesystem::path source_path = dir / (temporary + ".cpp");
+	const std::filesystem::path temporary_object = dir / (temporary + ".so");
+	{
+		std::ofstream file(source_path);
+		file << source;
+		if (!file)
+			return {};
+	}
+
+	std::vector<std::string> compilers;
+	if (const char* cxx = std::getenv("CXX"); cxx && *cxx)
+		compilers.emplace_back(cxx);
+	compilers.emplace_back("g++");
+	compilers.emplace_back("clang++");
+
+	bool built = false;
+	for (auto&& compiler : compilers)
+	{
+		const std::string command = std::format("{} {} -o {} {} >/dev/null 2>&1", shell_quote(compiler), ahead_of_time_flags, shell_quote(temporary_object.string()), shell_quote(source_path.string()));
+		if (std::system(command.c_str()) == 0)
+		{
+			built = true;
+			break;
+		}
+	}
+	std::filesystem::remove(source_path, ec);
+	if (!built)
+		return {};
+
+	std::filesystem::rename(temporary_object, object, ec);
+	if (ec)
+	{
+		std::filesystem::remove(temporary_object, ec);
+		return {};
+	}
+	return native_module(object, ahead_of_time_symbol);
+#endif
+}
+
+
+struct executable_formula
+{
+	std::unique_ptr<expression_node> root;
+	expression_dag dag;
+	std::vector<bytecode_word> code;
+
+	std::atomic<size_t> evaluations = 0;
+	std::atomic<const compiled_formula*> compiled = nullptr;
+	std::unique_ptr<compiled_formula> compiled_storage;
+	std::once_flag compile_flag;
+	std::thread compiler;
+
+	std::atomic<native_function> ahead_of_time = nullptr;
+	native_module module;
+	std::once_flag ahead_of_time_flag;
+
+	void compile() noexcept
+	{
+		std::call_once(this->compile_flag, [this]
+		{
+			try
+			{
+				this->compiled_storage = compile_formula(this->dag);
+				this->compiled.store(this->compiled_storage.get(), std::memory_order_release);
+			}
+			catch (...)
+			{
+			}
+		});
+	}
+	void start_compiler() noexcept
+	{
+		try
+		{
+			this->compiler = std::thread(&executable_formula::compile, this);
+		}
+		catch (...)
+		{
+			this->compile();
+		}
+	}
+
+	~executable_formula()
+	{
+		if (this->compiler.joinable())
+			this->compiler.join();
+	}
+};
+
+formula::formula(const std::string& expression, size_t compile_threshold)
+	: m_compile_threshold(compile_threshold)
+{
+	this->m_expr.reserve(expression.size());
+	for (auto&& c : expression)
+	{
+		if (!std::isblank(c))
+			this->m_expr += c;
+	}
+
+	parse_context cntxt(this->m_expr);
+
+	::expression root;
+	if (parse_expression(cntxt, root))
+	{
+		this->m_eliminated_nodes = simplify_and_count(root);
+		this->m_executable = std::make_unique<executable_formula>();
+		this->m_executable->dag = build_dag(*root);
+		this->m_executable->code = compile_bytecode(this->m_executable->dag);
+		this->m_executable->root = std::move(root);
+		if (compile_threshold == 0)
+			this->m_executable->compile();
+	}
+
+	this->m_parse_error = std::move(cntxt.error_message);
+	this->m_parse_stop = cntxt.p - this->m_expr.data();
+}
+formula::formula(formula&&) noexcept = default;
+formula& formula::operator=(formula&&) noexcept = default;
+formula::~formula() = default;
+
+bool formula::validate(std::string& err_msg, const char*& err_pos) const noexcept
+{
+	int parentheses_level = 0;
+	for (auto&& c : this->m_expr)
+	{
+		if (c == '(')
+			++parentheses_level;
+		if (c == ')')
+			--parentheses_level;
+		if (parentheses_level < 0)
+		{
+			err_pos = &c;
+			err_msg = "unexpected ')'";
+			return false;
+		}
+	}
+	if (parentheses_level != 0)
+	{
+		err_pos = this->m_expr.data() + this->m_expr.size();
+		err_msg = "no ')' to match '('";
+		return false;
+	}
+
+	const bool parse_result = this->m_executable != nullptr;
+
+	err_msg = this->m_parse_error;
+	if (!parse_result && err_msg.empty())
+		err_msg = "failed to classify token sequence";
+	err_pos = this->m_expr.data() + this->m_parse_stop;
+	return parse_result;
+}
+
+
+double formula::operator()(double x) const
+{
+	if (!this->m_executable)
+		return std::bit_cast<double>(0xFFFFFFFFFFFFFFFF);
+
+	executable_formula& executable = *this->m_executable;
+	if (auto entry = executable.ahead_of_time.load(std::memory_order_acquire))
+		return entry(x);
+	if (auto compiled = executable.compiled.load(std::memory_order_acquire))
+		return run_compiled(*compiled, x);
+
+	if (executable.evaluations.fetch_add(1, std::memory_order_relaxed) + 1 == this->m_compile_threshold)
+		executable.start_compiler();
+
+	if (executable.code.empty())
+		return ::evaluate(*executable.root, x);
+	return run_bytecode(executable.code.data(), x);
+}
+
+template<class T>
+T formula::eval(T x) const
+{
+	if constexpr (std::is_same_v<T, double>)
+		return (*this)(x);
+	else
+	{
+		if (!this->m_executable)
+			return T(NAN);
+
+		//Interpreted until hot, like operator()
+		executable_formula& executable = *this->m_executable;
+		if (auto compiled = executable.compiled.load(std::memory_order_acquire))
+			return run_registers<accuracy::exact, T>(*compiled->program, x);
+
+		if (executable.evaluations.fetch_add(1, std::memory_order_relaxed) + 1 == this->m_compile_threshold)
+			executable.start_compiler();
+		return ::evaluate(*executable.root, x);
+	}
+}
+
+void formula::evaluate(std::span<const double> xs, std::span<double> out, accuracy policy) const
+{
+	const size_t n = std::min(xs.size(), out.size());
+	if (!this->m_executable)
+	{
+		std::fill_n(out.begin(), n, std::bit_cast<double>(0xFFFFFFFFFFFFFFFF));
+		return;
+	}
+
+	executable_formula& executable = *this->m_executable;
+	auto compiled = executable.compiled.load(std::memory_order_acquire);
+	if (!compiled)
+	{
+		const size_t before = executable.evaluations.fetch_add(n, std::memory_order_relaxed);
+		if (before + n >= this->m_compile_threshold || policy != accuracy::exact)
+		{
+			executable.compile();
+			compiled = executable.compiled.load(std::memory_order_acquire);
+		}
+	}
+
+	if (compiled)
+		get_batch_kernel(policy)(*compiled->program, xs.data(), out.data(), n);
+	else if (!executable.code.empty())
+		for (size_t i = 0; i < n; ++i)
+			out[i] = run_bytecode(executable.code.data(), xs[i]);
+	else
+		for (size_t i = 0; i < n; ++i)
+			out[i] = ::evaluate(*executable.root, xs[i]);
+}
+
+//Without a compiled program the float path has nothing to vectorize, so it
+//evaluates in double and rounds.
+void formula::evaluate(std::span<const float> xs, std::span<float> out) const
+{
+	const size_t n = std::min(xs.size(), out.size());
+	if (!this->m_executable)
+	{
+		std::fill_n(out.begin(), n, std::bit_cast<float>(0xFFFFFFFF));
+		return;
+	}
+
+	executable_formula& executable = *this->m_executable;
+	auto compiled = executable.compiled.load(std::memory_order_acquire);
+	if (!compiled)
+	{
+		executable.compile();
+		compiled = executable.compiled.load(std::memory_order_acquire);
+	}
+
+	if (compiled)
+		get_float_batch_kernel()(*compiled->program, xs.data(), out.data(), n);
+	else
+		for (size_t i = 0; i < n; ++i)
+			out[i] = float((*this)(xs[i]));
+}
+
+bool formula::compile_ahead_of_time() const
+{
+	if (!this->m_executable)
+		return false;
+
+	executable_formula& executable = *this->m_executable;
+	std::call_once(executable.ahead_of_time_flag, [&]
+	{
+		try
+		{
+			executable.module = load_ahead_of_time(executable.dag);
+			if (executable.module)
+				executable.ahead_of_time.store(executable.module.entry(), std::memory_order_release);
+		}
+		catch (...)
+		{
+		}
+	});
+	return executable.ahead_of_time.load(std::memory_order_acquire) != nullptr;
+}
+
+formula formula::derivative(size_t compile_threshold) const
+{
+	if (!this->m_executable)
+		return formula("", compile_threshold);
+
+	expression root = derive(*this->m_executable->root);
+	if (!root)
+		root = make_literal(0);
+	simplify(root);
+	return formula(to_string(*root), compile_threshold);
+}
+const std::string& formula::text() const noexcept
+{
+	return this->m_expr;
+}
+
+size_t formula::eliminated_nodes() const noexcept
+{
+	return this->m_eliminated_nodes;
+}
+
+parse_context::parse_context(const std::string_view& str) noexcept
+	: p(str.data()), pe(str.data() + str.size())
+{
+}
+
+
+
+//Formulas known at compile time. static_formula<"x^3-2*x-5"> parses its string
+//during compilation with the grammar of formula, folds the same constants and
+//expands the same power chains, so it gives the same results as formula but
+//evaluates as straight-line code that the compiler can inline and optimize.
+template<size_t N>
+struct fixed_string
+{
+	char chars[N]{};
+
+	constexpr fixed_string(const char (&str)[N])
+	{
+		std::copy_n(str, N, this->chars);
+	}
+	constexpr std::string_view view() const
+	{
+		return std::string_view(this->chars, N - 1);
+	}
+};
+
+//Just enough of an unsigned big integer to round decimal literals exactly
+class static_bignum
+{
+	static constexpr size_t capacity = 64;
+	uint32_t m_limbs[capacity]{};
+	size_t m_size = 0;
+
+	constexpr void push(uint32_t limb)
+	{
+		if (this->m_size == capacity)
+			throw "static_formula: literal out of range";
+		this->m_limbs[this->m_size++] = limb;
+	}
+
+public:
+	constexpr static_bignum(uint32_t value = 0)
+	{
+		if (value != 0)
+			this->push(value);
+	}
+
+	constexpr void multiply_add(uint32_t factor, uint32_t addend)
+	{
+		uint64_t carry = addend;
+		for (size_t i = 0; i < this->m_size; ++i)
+		{
+			carry += uint64_t(this->m_limbs[i]) * factor;
+			this->m_limbs[i] = uint32_t(carry);
+			carry >>= 32;
+		}
+		if (carry != 0)
+			this->push(uint32_t(carry));
+	}
+	constexpr void shift_left(size_t bits)
+	{
+		if (this->m_size == 0)
+			return;
+		this->multiply_add(uint32_t(1) << bits % 32, 0);
+
+		const size_t limbs = bits / 32;
+		if (this->m_size + limbs > capacity)
+			throw "static_formula: literal out of range";
+		for (size_t i = this->m_size; i-- > 0;)
+			this->m_limbs[i + limbs] = this->m_limbs[i];
+		for (size_t i = 0; i < limbs; ++i)
+			this->m_limbs[i] = 0;
+		this->m_size += limbs;
+	}
+	constexpr void subtract(const static_bignum& other)
+	{
+		uint32_t borrow = 0;
+		for (size_t i = 0; i < this->m_size; ++i)
+		{
+			const uint64_t subtrahend = uint64_t(i < other.m_size ? other.m_limbs[i] : 0) + borrow;
+			borrow = this->m_limbs[i] < subtrahend;
+			this->m_limbs[i] = uint32_t(this->m_limbs[i] - subtrahend);
+		}
+		while (this->m_size != 0 && this->m_limbs[this->m_size - 1] == 0)
+			--this->m_size;
+	}
+
+	constexpr size_t bit_length() const
+	{
+		if (this->m_size == 0)
+			return 0;
+		return 32 * (this->m_size - 1) + std::bit_width(this->m_limbs[this->m_size - 1]);
+	}
+	constexpr int compare(const static_bignum& other) const
+	{
+		if (this->m_size != other.m_size)
+			return this->m_size < other.m_size ? -1 : 1;
+		for (size_t i = this->m_size; i-- > 0;)
+		{
+			if (this->m_limbs[i] != other.m_limbs[i])
+				return this->m_limbs[i] < other.m_limbs[i] ? -1 : 1;
+		}
+		return 0;
+	}
+};
+
+//digits * 10^exponent rounded to the nearest double, ties to even. Results
+//that overflow or round to zero fail, as std::from_chars reports them out of range.
+constexpr bool static_decimal_to_double(std::string_view digits, int exponent, bool negative, double& value)
+{
+	const int magnitude = int(digits.size()) + exponent;
+	if (magnitude > 309 || magnitude <= -324)
+		return false;
+
+	static_bignum numerator, denominator(1);
+	for (char c : digits)
+		numerator.multiply_add(10, uint32_t(c - '0'));
+	for (int i = 0; i < exponent; ++i)
+		numerator.multiply_add(10, 0);
+	for (int i = 0; i > exponent; --i)
+		denominator.multiply_add(10, 0);
+
+	//numerator * 2^shift / denominator in [2^52, 2^53), or with the subnormal
+	//scale 2^1074 when the value is below DBL_MIN
+	auto scale = [&](int shift, static_bignum& n, static_bignum& d)
+	{
+		n = numerator;
+		d = denominator;
+		if (shift >= 0)
+			n.shift_left(size_t(shift));
+		else
+			d.shift_left(size_t(-shift));
+	};
+	int shift = 52 - (int(numerator.bit_length()) - int(denominator.bit_length()));
+	static_bignum n, d;
+	scale(shift, n, d);
+	static_bignum lower_bound = d;
+	lower_bound.shift_left(52);
+	if (n.compare(lower_bound) < 0)
+		++shift;
+	if (shift > 1074)
+		shift = 1074;
+	scale(shift, n, d);
+
+	uint64_t quotient = 0;
+	for (int bit = 53; bit >= 0; --bit)
+	{
+		static_bignum term = d;
+		term.shift_left(size_t(bit));
+		if (n.compare(term) >= 0)
+		{
+			n.subtract(term);
+			quotient |= uint64_t(1) << bit;
+		}
+	}
+	n.shift_left(1);
+	const int half = n.compare(d);
+	if (half > 0 || (half == 0 && (quotient & 1)))
+		++quotient;
+	if (quotient == uint64_t(1) << 53)
+	{
+		quotient >>= 1;
+		--shift;
+	}
+
+	uint64_t bits = quotient;
+	if (quotient == 0)
+		return false;
+	if (quotient >= uint64_t(1) << 52)
+	{
+		const int binary_exponent = 52 - shift;
+		if (binary_exponent > 1023)
+			return false;
+		bits = uint64_t(binary_exponent + 1023) << 52 | (quotient - (uint64_t(1) << 52));
+	}
+	value = std::bit_cast<double>(bits | uint64_t(negative) << 63);
+	return true;
+}
+
+constexpr bool static_is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+//std::from_chars for double in the general format, in constant expressions
+constexpr bool static_from_chars(std::string_view str, size_t& length, double& value)
+{
+	size_t i = 0;
+	const bool negative = i < str.size() && str[i] == '-';
+	i += negative;
+
+	auto matches = [&](std::string_view word)
+	{
+		if (str.size() - i < word.size())
+			return false;
+		for (size_t j = 0; j < word.size(); ++j)
+		{
+			if ((str[i + j] | 0x20) != word[j])
+				return false;
+		}
+		return true;
+	};
+	if (matches("inf"))
+	{
+		length = i + (matches("infinity") ? 8 : 3);
+		value = negative ? -std::numeric_limits<double>::infinity() : std::numeric_limits<double>::infinity();
+		return true;
+	}
+	if (matches("nan"))
+	{
+		i += 3;
+		if (i < str.size() && str[i] == '(')
+		{
+			size_t j = i + 1;
+			while (j < str.size() && (static_is_digit(str[j]) || ((str[j] | 0x20) >= 'a' && (str[j] | 0x20) <= 'z') || str[j] == '_'))
+				++j;
+			if (j < str.size() && str[j] == ')')
+				i = j + 1;
+		}
+		length = i;
+		value = negative ? -std::numeric_limits<double>::quiet_NaN() : std::numeric_limits<double>::quiet_NaN();
+		return true;
+	}
+
+	constexpr size_t max_digits = 100;
+	char digits[max_digits]{};
+	size_t count = 0;
+	int exponent = 0;
+	bool any_digits = false;
+	auto add_digit = [&](char c)
+	{
+		any_digits = true;
+		if (count == 0 && c == '0')
+			return;
+		if (count == max_digits)
+			throw "static_formula: too many digits in a literal";
+		digits[count++] = c;
+	};
+
+	for (; i < str.size() && static_is_digit(str[i]); ++i)
+		add_digit(str[i]);
+	if (i < str.size() && str[i] == '.')
+	{
+		for (++i; i < str.size() && static_is_digit(str[i]); ++i)
+		{
+			add_digit(str[i]);
+			--exponent;
+		}
+	}
+	if (!any_digits)
+		return false;
+
+	if (i < str.size() && (str[i] | 0x20) == 'e')
+	{
+		size_t j = i + 1;
+		const bool exponent_negative = j < str.size() && str[j] == '-';
+		j += j < str.size() && (str[j] == '-' || str[j] == '+');
+		if (j < str.size() && static_is_digit(str[j]))
+		{
+			int written = 0;
+			for (; j < str.size() && static_is_digit(str[j]); ++j)
+				written = std::min(written * 10 + (str[j] - '0'), 1'000'000);
+			exponent += exponent_negative ? -written : written;
+			i = j;
+		}
+	}
+	length = i;
+
+	while (count != 0 && digits[count - 1] == '0')
+	{
+		--count;
+		++exponent;
+	}
+	if (count == 0)
+	{
+		value = negative ? -0.0 : 0.0;
+		return true;
+	}
+	return static_decimal_to_double(std::string_view(digits, count), exponent, negative, value);
+}
+
+struct static_node
+{
+	node_type type = node_type::literal;
+	opcode op = opcode::ret;
+	double value = 0;
+	int lhs = -1, rhs = -1;
+	bool constant = false; //no x below, set by static_fold_constants
+};
+
+template<size_t N>
+struct static_expression
+{
+	static_node nodes[N]{};
+	int size = 0;
+	int root = -1;
+};
+
+constexpr int static_precedence(opcode op)
+{
+	switch (op)
+	{
+	case opcode::plus:
+	case opcode::minus:
+		return 1;
+	case opcode::power:
+		return 3;
+	default:
+		return 2;
+	}
+}
+
+//parse_expression and the functions it calls, on a node array. Failed
+//alternatives restore both the position and the node count.
+template<size_t N>
+class static_parser
+{
+	struct cursor
+	{
+		size_t p;
+		int size;
+	};
+	struct operand
+	{
+		int value = -1;
+		opcode next_operator = opcode::ret;
+	};
+
+	std::string_view m_str;
+	size_t m_p = 0;
+	static_expression<N>& m_expr;
+
+	constexpr cursor save() const
+	{
+		return { this->m_p, this->m_expr.size };
+	}
+	constexpr void restore(cursor saved)
+	{
+		this->m_p = saved.p;
+		this->m_expr.size = saved.size;
+	}
+	constexpr bool at_end() const
+	{
+		return this->m_p == this->m_str.size();
+	}
+	constexpr bool at_end_or_close() const
+	{
+		return this->at_end() || this->m_str[this->m_p] == ')';
+	}
+	constexpr bool try_match(std::string_view word)
+	{
+		if (this->m_str.substr(this->m_p, word.size()) != word)
+			return false;
+		this->m_p += word.size();
+		return true;
+	}
+
+	constexpr int add(node_type type, opcode op, int lhs = -1, int rhs = -1, double value = 0)
+	{
+		if (this->m_expr.size == int(N))
+			throw "static_formula: node array overflow";
+		this->m_expr.nodes[this->m_expr.size] = { type, op, value, lhs, rhs };
+		return this->m_expr.size++;
+	}
+
+	constexpr bool try_parse_literal(int& var)
+	{
+		size_t length = 0;
+		double value = 0;
+		if (!static_from_chars(this->m_str.substr(this->m_p), length, value))
+			return false;
+		this->m_p += length;
+		var = this->add(node_type::literal, opcode::push_const, -1, -1, value);
+		return true;
+	}
+	constexpr bool try_parse_variable(int& var)
+	{
+		if (!this->try_match("x"))
+			return false;
+		var = this->add(node_type::variable, opcode::push_x);
+		return true;
+	}
+	constexpr bool try_parse_function(int& var)
+	{
+		constexpr std::pair<std::string_view, opcode> functions[] = {
+			{ "sin(", opcode::sin },
+			{ "cos(", opcode::cos },
+			{ "tan(", opcode::tan },
+			{ "ctg(", opcode::ctg },
+			{ "sqrt(", opcode::sqrt },
+			{ "cbrt(", opcode::cbrt },
+			{ "sqr(", opcode::sqr },
+			{ "abs(", opcode::abs },
+			{ "exp(", opcode::exp },
+			{ "ln(", opcode::ln },
+			{ "lg(", opcode::lg },
+			{ "log2(", opcode::log2 },
+		};
+
+		for (auto&& [name, op] : functions)
+		{
+			if (!this->try_match(name))
+				continue;
+
+			int arg = -1;
+			if (!this->parse_expression(arg) || !this->try_match(")"))
+				return false;
+			var = this->add(node_type::function, op, arg);
+			return true;
+		}
+		return false;
+	}
+	constexpr bool try_parse_unary_expr(int& var)
+	{
+		const bool negate = this->try_match("-");
+		if (!negate && !this->try_match("+"))
+			return false;
+
+		if (!this->parse_expression(var))
+			return false;
+		if (negate)
+			var = this->add(node_type::negation, opcode::negate, var);
+		return true;
+	}
+	constexpr bool try_parse_nested_expression(int& var)
+	{
+		return this->try_match("(") && this->parse_expression(var) && this->try_match(")");
+	}
+	constexpr bool try_parse_operand(int& var)
+	{
+		const cursor saved = this->save();
+
+		if (this->try_parse_literal(var))
+			return true;
+		this->restore(saved);
+
+		if (this->try_parse_variable(var))
+			return true;
+		this->restore(saved);
+
+		if (this->try_parse_function(var))
+			return true;
+		this->restore(saved);
+
+		return this->try_parse_nested_expression(var);
+	}
+	constexpr bool try_match_binary_operator(opcode& op)
+	{
+		//"//" before "/", the only operator that is a prefix of another
+		constexpr std::pair<std::string_view, opcode> binary_operators[] = {
+			{ "+", opcode::plus },
+			{ "-", opcode::minus },
+			{ "*", opcode::multiply },
+			{ "//", opcode::divide_integer },
+			{ "/", opcode::divide },
+			{ "%", opcode::remainder },
+			{ "^", opcode::power },
+		};
+
+		for (auto&& [name, value] : binary_operators)
+		{
+			if (this->try_match(name))
+			{
+				op = value;
+				return true;
+			}
+		}
+		return false;
+	}
+	constexpr bool takes_precedence(opcode op1, opcode op2) const
+	{
+		return op1 == opcode::power || static_precedence(op1) > static_precedence(op2);
+	}
+
+	constexpr bool try_parse_binary_expr(int& var, operand* p_operand1 = nullptr)
+	{
+		operand operand1_local;
+
+		if (p_operand1 == nullptr)
+		{
+			if (!this->try_parse_operand(operand1_local.value))
+				return false;
+
+			if (this->at_end_or_close())
+			{
+				var = operand1_local.value;
+				return true;
+			}
+
+			if (!this->try_match_binary_operator(operand1_local.next_operator))
+				return false;
+
+			p_operand1 = &operand1_local;
+		}
+
+		operand& operand1 = *p_operand1;
+		operand operand2;
+
+		if (!this->try_parse_operand(operand2.value))
+			return false;
+		if (this->at_end_or_close())
+		{
+			var = this->add(node_type::binary, operand1.next_operator, operand1.value, operand2.value);
+			return true;
+		}
+
+		if (!this->try_match_binary_operator(operand2.next_operator))
+			return false;
+
+		if (this->takes_precedence(operand2.next_operator, operand1.next_operator))
+		{
+			int rest = -1;
+			if (!this->try_parse_binary_expr(rest, &operand2))
+				return false;
+			var = this->add(node_type::binary, operand1.next_operator, operand1.value, rest);
+			return true;
+		}
+
+		operand2.value = this->add(node_type::binary, operand1.next_operator, operand1.value, operand2.value);
+		return this->try_parse_binary_expr(var, &operand2);
+	}
+
+public:
+	constexpr static_parser(std::string_view str, static_expression<N>& expr)
+		: m_str(str), m_expr(expr)
+	{
+	}
+
+	constexpr bool parse_expression(int& var)
+	{
+		if (this->at_end())
+			return false;
+
+		const cursor saved = this->save();
+
+		if (this->try_parse_binary_expr(var))
+			return true;
+		this->restore(saved);
+
+		if (this->try_parse_function(var))
+			return true;
+		this->restore(saved);
+
+		return this->try_parse_unary_expr(var);
+	}
+};
+
+//The constants that simplify folds. Arithmetic is folded here, so that the
+//exponent of a power chain can come from it; libm is not constexpr, so the
+//rest are only marked constant and evaluated exactly by static_formula.
+template<size_t N>
+constexpr void static_fold_constants(static_expression<N>& expr, int index)
+{
+	static_node& node = expr.nodes[index];
+	if (node.lhs >= 0)
+		static_fold_constants(expr, node.lhs);
+	if (node.rhs >= 0)
+		static_fold_constants(expr, node.rhs);
+
+	const bool lhs_literal = node.lhs >= 0 && expr.nodes[node.lhs].type == node_type::literal;
+	const bool rhs_literal = node.rhs >= 0 && expr.nodes[node.rhs].type == node_type::literal;
+	node.constant = node.type != node_type::variable
+		&& (node.lhs < 0 || expr.nodes[node.lhs].constant)
+		&& (node.rhs < 0 || expr.nodes[node.rhs].constant);
+	if (node.type == node_type::negation && lhs_literal)
+		node = { node_type::literal, opcode::push_const, -expr.nodes[node.lhs].value, -1, -1, true };
+	if (node.type != node_type::binary || !lhs_literal || !rhs_literal)
+		return;
+
+	const double a = expr.nodes[node.lhs].value, b = expr.nodes[node.rhs].value;
+	switch (node.op)
+	{
+	case opcode::plus: node = { node_type::literal, opcode::push_const, a + b, -1, -1, true }; break;
+	case opcode::minus: node = { node_type::literal, opcode::push_const, a - b, -1, -1, true }; break;
+	case opcode::multiply: node = { node_type::literal, opcode::push_const, a * b, -1, -1, true }; break;
+	case opcode::divide: node = { node_type::literal, opcode::push_const, a / b, -1, -1, true }; break;
+	default: break;
+	}
+}
+
+//The formula constructor and validate, at compile time: blanks are dropped,
+//parentheses must balance and the whole string must parse
+template<size_t N>
+constexpr static_expression<N> parse_static_formula(std::string_view str)
+{
+	static_expression<N> expr;
+
+	char stripped[N]{};
+	size_t size = 0;
+	int parentheses_level = 0;
+	for (char c : str)
+	{
+		if (c == ' ' || c == '\t')
+			continue;
+		stripped[size++] = c;
+		parentheses_level += (c == '(') - (c == ')');
+		if (parentheses_level < 0)
+			return expr;
+	}
+	if (parentheses_level != 0)
+		return expr;
+
+	static_parser<N> parser(std::string_view(stripped, size), expr);
+	int root = -1;
+	if (parser.parse_expression(root))
+	{
+		static_fold_constants(expr, root);
+		expr.root = root;
+	}
+	return expr;
+}
+
+//dag_builder::power_chain, multiplied in the same order
+template<class T>
+T static_power_chain(T square, int n)
+{
+	T result = square;
+	bool empty = true;
+	for (int exponent = n; ; exponent >>= 1)
+	{
+		if (exponent & 1)
+		{
+			result = empty ? square : result * square;
+			empty = false;
+		}
+		if (exponent >> 1 == 0)
+			return result;
+		square = square * square;
+	}
+}
+
+template<fixed_string S>
+class static_formula
+{
+	static constexpr auto m_expr = parse_static_formula<sizeof(S.chars)>(S.view());
+	static_assert(m_expr.root >= 0, "static_formula: the expression does not parse");
+
+	template<accuracy A, int I, class T>
+	static T evaluate(T x)
+	{
+		constexpr static_node node = m_expr.nodes[I];
+		if constexpr (node.type == node_type::literal)
+			return T(node.value);
+		else if constexpr (node.type == node_type::variable)
+			return x;
+		else if constexpr (node.constant && (A != accuracy::exact || !std::is_same_v<T, double>))
+			return T(evaluate<accuracy::exact, I>(0.0)); //as simplify folds it
+		else if constexpr (node.type == node_type::negation)
+			return -evaluate<A, node.lhs>(x);
+		else if constexpr (node.type == node_type::function)
+			return math_function<A, node.op>(evaluate<A, node.lhs>(x));
+		else if constexpr (node.op == opcode::power && m_expr.nodes[node.rhs].constant && !m_expr.nodes[node.lhs].constant)
+			return power(evaluate<A, node.lhs>(x), evaluate<accuracy::exact, node.rhs>(0.0));
+		else
+		{
+			const T a = evaluate<A, node.lhs>(x), b = evaluate<A, node.rhs>(x);
+			if constexpr (node.op == opcode::plus) return a + b;
+			else if constexpr (node.op == opcode::minus) return a - b;
+			else if constexpr (node.op == opcode::multiply) return a * b;
+			else if constexpr (node.op == opcode::divide) return a / b;
+			else if constexpr (node.op == opcode::divide_integer) return math_divide_integer(a, b);
+			else if constexpr (node.op == opcode::remainder) return math_remainder(a, b);
+			else return math_power(a, b);
+		}
+	}
+
+	//The power rewrites of simplify and dag_builder::try_add_power_chain, for
+	//an exponent that simplify folds to a literal. It is known at compile
+	//time unless it comes from a function call, and then the compiler folds it.
+	template<class T>
+	static T power(T base, double exponent)
+	{
+		if (exponent == 0)
+			return T(1);
+		if (exponent == -1)
+			return T(1) / base;
+		if (!(exponent * 2 >= 1 && exponent * 2 <= 32 && int(exponent * 2) == exponent * 2))
+			return math_power(base, T(exponent));
+
+		const int whole = int(exponent);
+		if (whole == exponent)
+			return static_power_chain(base, whole);
+		if (whole == 0)
+			return math_function<accuracy::exact, opcode::sqrt>(base);
+		return static_power_chain(base, whole) * math_function<accuracy::exact, opcode::sqrt>(base);
+	}
+
+public:
+	static constexpr std::string_view text = S.view();
+
+	//The same accuracy tiers as formula::evaluate
+	template<class T>
+	static T eval(T x, accuracy policy = accuracy::exact)
+	{
+		switch (policy)
+		{
+		case accuracy::faithful: return evaluate<accuracy::faithful, m_expr.root>(x);
+		case accuracy::fast: return evaluate<accuracy::fast, m_expr.root>(x);
+		default: return evaluate<accuracy::exact, m_expr.root>(x);
+		}
+	}
+	double operator()(double x) const
+	{
+		return eval(x);
+	}
+};
+
+
+#include <chrono>
+
+template<class Callable>
+double measure_ns_per_call(Callable&& callable, size_t iterations)
+{
+	volatile double sink = 0;
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < iterations; ++i)
+		sink = sink + callable(-2 + 5 * double(i) / iterations);
+	const auto stop = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(stop - start).count() / iterations;
+}
+
+double measure_ns_per_element(const formula& f, size_t iterations, accuracy policy = accuracy::faithful)
+{
+	std::vector<double> xs(4096), ys(xs.size());
+	for (size_t i = 0; i < xs.size(); ++i)
+		xs[i] = -2 + 5 * double(i) / xs.size();
+
+	const size_t rounds = std::max<size_t>(1, iterations / xs.size());
+	volatile double sink = 0;
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < rounds; ++i)
+	{
+		f.evaluate(xs, ys, policy);
+		sink = sink + ys[i % ys.size()];
+	}
+	const auto stop = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(stop - start).count() / (rounds * xs.size());
+}
+
+uint64_t ulp_distance(double a, double b)
+{
+	if (std::isnan(a) || std::isnan(b))
+		return std::isnan(a) && std::isnan(b) ? 0 : UINT64_MAX;
+
+	auto ordered = [](double x)
+	{
+		const auto bits = std::bit_cast<int64_t>(x);
+		return bits < 0 ? INT64_MIN - bits : bits;
+	};
+	const int64_t ia = ordered(a), ib = ordered(b);
+	return ia > ib ? uint64_t(ia) - uint64_t(ib) : uint64_t(ib) - uint64_t(ia);
+}
+
+double relative_error(double y, double reference)
+{
+	if (std::isnan(y) || std::isnan(reference))
+		return std::isnan(y) && std::isnan(reference) ? 0 : INFINITY;
+	if (y == reference)
+		return 0;
+	if (std::isinf(y) || std::isinf(reference))
+		return INFINITY;
+	return fabs(y - reference) / std::max(fabs(reference), DBL_MIN);
+}
+
+void run_power_chain_benchmark()
+{
+	std::cout << std::format("\n{:<10} {:>10} {:>10} {:>14}\n", "x^n", "pow", "chain", "max ulp diff");
+	for (double n : { 3.0, 4.0, 5.0, 7.0, 10.0, 16.0, 0.5, 2.5, 7.5, -1.0 })
+	{
+		const formula f(std::format("x^{}", n), 0);
+		const double pow_time = measure_ns_per_call([&](double x) { return pow(x, n); }, 10'000'000);
+		const double chain_time = measure_ns_per_call(f, 10'000'000);
+
+		uint64_t max_ulp = 0;
+		for (int i = 1; i <= 1'000'000; ++i)
+		{
+			const double x = std::exp2(-30 + 60.0 * i / 1'000'000);
+			max_ulp = std::max(max_ulp, ulp_distance(f(x), pow(x, n)));
+		}
+		std::cout << std::format("{:<10} {:>10.2f} {:>10.2f} {:>14}\n", std::format("x^{}", n), pow_time, chain_time, max_ulp);
+	}
+}
+
+void run_simd_benchmark()
+{
+	static const std::string_view corpus[] = {
+		"x^3-2*x-5",
+		"x^7-3*x^5+x^3-1",
+		"sqrt(abs(x))*(x//3)-1/x",
+		"sin(x)^2+sin(x)*cos(x)+exp(-x)*sin(x)",
+		"exp(-x*x)*cos(3*x)",
+		"ln(x*x+1)-cbrt(x)",
+		"tan(x/4)+lg(x*x+2)+log2(x*x+3)",
+	};
+	const std::pair<const char*, simd_level> levels[] = {
+		{ "generic", simd_level::none },
+		{ "sse2", simd_level::sse2 },
+		{ "avx2", simd_level::avx2 },
+		{ "avx512", simd_level::avx512 },
+	};
+	const simd_level supported = detect_simd_level();
+
+	std::cout << std::format("\n{:<40}", "batch kernel, ns/element");
+	for (auto&& [name, level] : levels)
+		std::cout << std::format(" {:>10}", name);
+	std::cout << std::format(" {:>10}\n", "max ulp");
+
+	std::vector<double> xs(4096), ys(xs.size()), reference(xs.size());
+	for (size_t i = 0; i < xs.size(); ++i)
+		xs[i] = -2 + 5 * double(i) / xs.size();
+
+	for (auto&& expr : corpus)
+	{
+		const std::string str(expr);
+		parse_context cntxt(str);
+		expression root;
+		parse_expression(cntxt, root);
+		simplify_and_count(root);
+		const auto program = compile_registers(build_dag(*root));
+		run_registers_batch(*program, xs.data(), reference.data(), xs.size());
+
+		std::cout << std::format("{:<40}", expr);
+		uint64_t max_ulp = 0;
+		for (auto&& [name, level] : levels)
+		{
+			if (level > supported)
+			{
+				std::cout << std::format(" {:>10}", "n/a");
+				continue;
+			}
+
+			const batch_kernel kernel = get_batch_kernel(level, accuracy::faithful);
+			const size_t rounds = 2500;
+			volatile double sink = 0;
+			const auto start = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < rounds; ++i)
+			{
+				kernel(*program, xs.data(), ys.data(), xs.size());
+				sink = sink + ys[i % ys.size()];
+			}
+			const auto stop = std::chrono::steady_clock::now();
+
+			for (size_t i = 0; i < xs.size(); ++i)
+				max_ulp = std::max(max_ulp, ulp_distance(ys[i], reference[i]));
+			const double ns = std::chrono::duration<double, std::nano>(stop - start).count() / (rounds * xs.size());
+			std::cout << std::format(" {:>10.2f}", ns);
+		}
+		std::cout << std::format(" {:>10}\n", max_ulp);
+	}
+}
+
+void run_accuracy_benchmark()
+{
+	static const std::string_view corpus[] = {
+		"sin(x)^2+sin(x)*cos(x)+exp(-x)*sin(x)",
+		"exp(-x*x)*cos(3*x)",
+		"ln(x*x+1)-cbrt(x)",
+		"tan(x/4)+lg(x*x+2)+log2(x*x+3)",
+	};
+	const std::pair<const char*, accuracy> tiers[] = {
+		{ "exact", accuracy::exact },
+		{ "faithful", accuracy::faithful },
+		{ "fast", accuracy::fast },
+	};
+
+	std::cout << std::format("\n{:<40} {:>10} {:>10} {:>10}\n", "accuracy tier, ns", "tier", "batch", "max error");
+	for (auto&& expr : corpus)
+	{
+		const formula f(std::string(expr), 0);
+		std::vector<double> xs(4096), ys(xs.size()), reference(xs.size());
+		for (size_t i = 0; i < xs.size(); ++i)
+			xs[i] = -2 + 5 * double(i) / xs.size();
+		f.evaluate(xs, reference, accuracy::exact);
+
+		for (auto&& [name, policy] : tiers)
+		{
+			const double batch = measure_ns_per_element(f, 10'000'000, policy);
+
+			f.evaluate(xs, ys, policy);
+			double max_error = 0;
+			for (size_t i = 0; i < xs.size(); ++i)
+				max_error = std::max(max_error, relative_error(ys[i], reference[i]));
+			std::cout << std::format("{:<40} {:>10} {:>10.2f} {:>10.2e}\n", &name == &tiers[0].first ? expr : "", name, batch, max_error);
+		}
+	}
+}
+
+//formula::eval<double> must cost the same as operator(); the other types
+//show what the generic path costs
+void run_scalar_type_benchmark()
+{
+	static const std::string_view corpus[] = {
+		"x^3-2*x-5",
+		"x^7-3*x^5+x^3-1",
+		"sin(x)^2+sin(x)*cos(x)+exp(-x)*sin(x)",
+		"ln(x*x+1)-cbrt(x)",
+	};
+
+	//Best of several short runs, since the first two columns should match
+	auto best_of = [](auto&& callable)
+	{
+		double best = INFINITY;
+		for (int i = 0; i < 5; ++i)
+			best = std::min(best, measure_ns_per_call(callable, 2'000'000));
+		return best;
+	};
+
+	std::cout << std::format("\n{:<40} {:>10} {:>10} {:>10} {:>10}\n", "scalar type, ns/call", "operator()", "double", "float", "long dbl");
+	for (auto&& expr : corpus)
+	{
+		const formula f(std::string(expr), 0);
+		const double call = best_of(f);
+		const double as_double = best_of([&](double x) { return f.eval(x); });
+		const double as_float = best_of([&](double x) { return f.eval(float(x)); });
+		const double as_long_double = best_of([&](double x) { return f.eval((long double)x); });
+		std::cout << std::format("{:<40} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.2f}\n", expr, call, as_double, as_float, as_long_double);
+	}
+}
+
+//One row of run_static_formula_benchmark: the same formula parsed at run time
+//and at compile time, timed, compared bit for bit at every tier, and solved
+//by both
+template<fixed_string S>
+void report_static_formula()
+{
+	const formula f(std::string(S.view()), 0);
+	const static_formula<S> sf;
+
+	auto best_of = [](auto&& callable)
+	{
+		double best = INFINITY;
+		for (int i = 0; i < 5; ++i)
+			best = std::min(best, measure_ns_per_call(callable, 2'000'000));
+		return best;
+	};
+	const double tiered = best_of(f);
+	const double inlined = best_of(sf);
+
+	size_t mismatches = 0;
+	std::vector<double> xs, ys(200001);
+	for (int i = -100000; i <= 100000; ++i)
+		xs.push_back(i / 10000.0);
+	for (size_t i = 0; i < xs.size(); ++i)
+		mismatches += ulp_distance(f(xs[i]), sf(xs[i])) != 0;
+	for (accuracy policy : { accuracy::faithful, accuracy::fast })
+	{
+		f.evaluate(xs, ys, policy);
+		for (size_t i = 0; i < xs.size(); ++i)
+			mismatches += ulp_distance(ys[i], sf.eval(xs[i], policy)) != 0;
+	}
+
+	//The solvers print their steps; only the roots matter here
+	std::cout.setstate(std::ios::failbit);
+	const double root = run_newthon_method(f, 1e-8, 0.5, 100);
+	const double static_root = run_newthon_method(sf, 1e-8, 0.5, 100);
+	std::cout.clear();
+	const bool same_root = std::bit_cast<uint64_t>(root) == std::bit_cast<uint64_t>(static_root) || (std::isnan(root) && std::isnan(static_root));
+
+	std::cout << std::format("{:<40} {:>10.2f} {:>10.2f} {:>10} {:>10}\n", S.view(), tiered, inlined, mismatches, same_root ? "same" : "differs");
+}
+
+void run_static_formula_benchmark()
+{
+	std::cout << std::format("\n{:<40} {:>10} {:>10} {:>10} {:>10}\n", "static formula, ns/call", "tiered", "static", "mismatch", "root");
+	report_static_formula<"x^3-2*x-5">();
+	report_static_formula<"x^7-3*x^5+x^3-1">();
+	report_static_formula<"sin(x)^2+sin(x)*cos(x)+exp(-x)*sin(x)">();
+	report_static_formula<"2*3.14159/180*x-ln(x+3)">();
+	report_static_formula<"sqrt(abs(x))*cbrt(x)-ctg(x+2)">();
+	report_static_formula<"x*sin(1)-exp(0.3)+ln(2)^3+x^(7//2)%5">();
+}
+
+void run_ahead_of_time_benchmark()
+{
+	static const std::string_view corpus[] = {
+		"x^3-2*x-5",
+		"x^7-3*x^5+x^3-1",
+		"sin(x)^2+sin(x)*cos(x)+exp(-x)*sin(x)",
+		"sqrt(abs(x))*cbrt(x)-ctg(x+2)",
+	};
+
+	//The compile column is the cost of the first call, near zero once cached
+	std::cout << std::format("\n{:<40} {:>10} {:>10} {:>10} {:>10}\n", "ahead of time, ns/call", "compile ms", "tiered", "aot", "mismatch");
+	for (auto&& expr : corpus)
+	{
+		const formula jit(std::string(expr), 0);
+		const formula aot(std::string(expr), 0);
+
+		const auto start = std::chrono::steady_clock::now();
+		const bool compiled = aot.compile_ahead_of_time();
+		const auto stop = std::chrono::steady_clock::now();
+		if (!compiled)
+		{
+			std::cout << std::format("{:<40} {:>10}\n", expr, "n/a");
+			continue;
+		}
+
+		size_t mismatches = 0;
+		for (int i = -100000; i <= 100000; ++i)
+		{
+			const double x = i / 10000.0;
+			mismatches += ulp_distance(jit(x), aot(x)) != 0;
+		}
+
+		const double compile_ms = std::chrono::duration<double, std::milli>(stop - start).count();
+		std::cout << std::format("{:<40} {:>10.1f} {:>10.2f} {:>10.2f} {:>10}\n", expr, compile_ms, measure_ns_per_call(jit, 10'000'000), measure_ns_per_call(aot, 10'000'000), mismatches);
+	}
+}
+
+//A formula that counts how often the solvers evaluate it, in any scalar type
+struct counting_formula
+{
+	const formula& f;
+	mutable size_t evaluations = 0;
+
+	template<class T>
+	T eval(T x) const
+	{
+		++this->evaluations;
+		return this->f.eval(x);
+	}
+};
+
+//Each method solves to 1e-12 from the same start. Every step costs one
+//evaluation, in dual, hyper-dual or Taylor arithmetic of growing degree.
+void run_householder_benchmark()
+{
+	struct problem
+	{
+		std::string_view expr;
+		double x0;
+	};
+	static const problem corpus[] = {
+		{ "x^3-2*x-5", -3 },
+		{ "exp(x)-3", 3 },
+		{ "x*exp(x)-1", 2 },
+		{ "sin(x)^2+exp(-x)*cos(x)", 2 },
+	};
+
+	std::cout << std::format("\n{:<40} {:<20} {:>10} {:>10} {:>24}\n", "formula", "method", "steps", "us/solve", "root");
+	for (auto&& [expr, x0] : corpus)
+	{
+		const formula f(std::string(expr), 0);
+		auto solve = [&](std::string_view method, auto&& solver)
+		{
+			counting_formula counter{ f };
+			std::cout.setstate(std::ios::failbit);
+			const double root = solver(counter);
+			const size_t evaluations = counter.evaluations;
+
+			constexpr int repeats = 200;
+			const auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < repeats; ++i)
+				solver(f);
+			const auto stop = std::chrono::steady_clock::now();
+			std::cout.clear();
+
+			const double us = std::chrono::duration<double, std::micro>(stop - start).count() / repeats;
+			std::cout << std::format("{:<40} {:<20} {:>10} {:>10.2f} {:>+24.16g}\n", expr, method, evaluations - 1, us, root);
+		};
+
+		solve("newthon (dual)", [&](auto&& g) { return run_newthon_method(g, 1e-12, x0, 100); });
+		solve("halley (hyper-dual)", [&](auto&& g) { return run_halley_method(g, 1e-12, x0, 100); });
+		for (size_t order = 1; order <= householder_max_order; ++order)
+			solve(std::format("householder {}", order), [&](auto&& g) { return run_householder_method(g, order, 1e-12, x0, 100); });
+	}
+}
+
+//Each bracketing method solves to 1e-12 from the same bracket. Evaluations
+//include those of the bracket ends.
+void run_bracketing_benchmark()
+{
+	struct problem
+	{
+		std::string_view expr;
+		double x1, x2;
+	};
+	static const problem corpus[] = {
+		{ "x^3-2*x-5", -3, -2 },
+		{ "exp(x)-3", 0, 3 },
+		{ "x*exp(x)-1", 0, 2 },
+		{ "sin(x)-0.5*x", 1, 3 },
+		{ "x^7-3*x^5+x^3-1", 1, 2 },
+		{ "ln(x)-1", 1, 5 },
+		{ "(x-1)^5", 0, 3 },
+		{ "cbrt(x-0.3)", -1, 2 },
+	};
+
+	std::cout << std::format("\n{:<40} {:<20} {:>10} {:>10} {:>24}\n", "formula", "method", "evals", "us/solve", "root");
+	for (auto&& [expr, x1, x2] : corpus)
+	{
+		const formula f(std::string(expr), 0);
+		auto solve = [&](std::string_view method, auto&& solver)
+		{
+			counting_formula counter{ f };
+			std::cout.setstate(std::ios::failbit);
+			const double root = solver(counter);
+
+			constexpr int repeats = 200;
+			const auto start = std::chrono::steady_clock::now();
+			for (int i = 0; i < repeats; ++i)
+				solver(f);
+			const auto stop = std::chrono::steady_clock::now();
+			std::cout.clear();
+
+			const double us = std::chrono::duration<double, std::micro>(stop - start).count() / repeats;
+			std::cout << std::format("{:<40} {:<20} {:>10} {:>10.2f} {:>+24.16g}\n", expr, method, counter.evaluations, us, root);
+		};
+
+		solve("dichotomy", [&](auto&& g) { return run_dichotomy_method(g, 1e-12, x1, x2, 200); });
+		solve("chord", [&](auto&& g) { return run_chord_method(g, 1e-12, x1, x2, 200); });
+		solve("brent", [&](auto&& g) { return run_brent_method(g, 1e-12, x1, x2, 200); });
+		solve("toms 748", [&](auto&& g) { return run_toms748_method(g, 1e-12, x1, x2, 200); });
+		solve("itp", [&](auto&& g) { return run_itp_method(g, 1e-12, x1, x2, 200); });
+	}
+}
+
+//Each estimator against the symbolic derivatives over a grid spanning the
+//root, as the largest error relative to the largest derivative. The old fixed
+//step of 0.01 is shown for reference. Evaluations include the noise estimate.
+void run_finite_difference_benchmark()
+{
+	struct problem
+	{
+		std::string_view expr;
+		double lo, hi;
+	};
+	static const problem corpus[] = {
+		{ "x^3-2*x-5", 1, 3 },
+		{ "sin(x)^2+exp(-x)*cos(x)", 0, 4 },
+		{ "sin(1e6*x)-0.5", 0, 1e-6 },
+		{ "ln(x)-20", 1e8, 1e9 },
+	};
+	constexpr int points = 100;
+
+	std::cout << std::format("\n{:<40} {:<24} {:>6} {:>10}\n", "formula", "finite difference", "evals", "error");
+	for (auto&& [expr, lo, hi] : corpus)
+	{
+		const formula f(std::string(expr), 0);
+		const formula df = f.derivative(0);
+		const formula d2f = df.derivative(0);
+		for (int order = 1; order <= 2; ++order)
+		{
+			const formula& exact = order == 1 ? df : d2f;
+			auto report = [&](std::string_view method, auto&& estimate)
+			{
+				double max_error = 0, max_exact = 0;
+				size_t evaluations = 0;
+				for (int i = 0; i < points; ++i)
+				{
+					const double x = lo + (hi - lo) * i / (points - 1);
+					const difference_estimate<double> d = estimate(x);
+					max_error = std::max(max_error, fabs(d.value - exact(x)));
+					max_exact = std::max(max_exact, fabs(exact(x)));
+					evaluations = d.evaluations;
+				}
+				std::cout << std::format("{:<40} {:<24} {:>6} {:>10.2e}\n", expr, method, evaluations, max_error / max_exact);
+			};
+
+			report(std::format("f{}, h = 0.01", order == 1 ? "'" : "''"), [&](double x)
+			{
+				constexpr double h = 0.01;
+				difference_estimate<double> d;
+				d.value = order == 1 ? (f(x + h) - f(x - h)) / (2 * h) : (f(x + h) - 2 * f(x) + f(x - h)) / (h * h);
+				d.evaluations = order + 1;
+				return d;
+			});
+			report(std::format("f{}, central", order == 1 ? "'" : "''"), [&](double x) { return estimate_derivative(f, x, order, false); });
+			report(std::format("f{}, richardson", order == 1 ? "'" : "''"), [&](double x) { return estimate_derivative(f, x, order); });
+		}
+	}
+}
+
+template<class T>
+double measure_batch_kernel(batch_kernel_of<T> kernel, const register_program& program, const std::vector<T>& xs, std::vector<T>& ys)
+{
+	const size_t rounds = 2500;
+	volatile double sink = 0;
+	const auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < rounds; ++i)
+	{
+		kernel(program, xs.data(), ys.data(), xs.size());
+		sink = sink + ys[i % ys.size()];
+	}
+	const auto stop = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(stop - start).count() / (rounds * xs.size());
+}
+
+void run_float_benchmark()
+{
+	static const std::string_view corpus[] = {
+		"x^3-2*x-5",
+		"x^7-3*x^5+x^3-1",
+		"sqrt(abs(x))*(x//3)-1/x",
+		"sin(x)^2+sin(x)*cos(x)+exp(-x)*sin(x)",
+		"ln(x*x+1)-cbrt(x)",
+	};
+	const std::pair<const char*, simd_level> levels[] = {
+		{ "generic", simd_level::none },
+		{ "sse2", simd_level::sse2 },
+		{ "avx2", simd_level::avx2 },
+		{ "avx512", simd_level::avx512 },
+	};
+	const simd_level supported = detect_simd_level();
+
+	std::cout << std::format("\n{:<40} {:>10}", "float kernel, ns/element", "double");
+	for (auto&& [name, level] : levels)
+		std::cout << std::format(" {:>10}", name);
+	std::cout << std::format(" {:>10}\n", "sign diff");
+
+	std::vector<double> xs(4096), ys(xs.size()), reference(xs.size());
+	std::vector<float> xs_float(xs.size()), ys_float(xs.size());
+	for (size_t i = 0; i < xs.size(); ++i)
+	{
+		xs_float[i] = float(-2 + 5 * double(i) / xs.size());
+		xs[i] = xs_float[i];
+	}
+
+	for (auto&& expr : corpus)
+	{
+		const std::string str(expr);
+		parse_context cntxt(str);
+		expression root;
+		parse_expression(cntxt, root);
+		simplify_and_count(root);
+		const auto program = compile_registers(build_dag(*root));
+		run_registers_batch(*program, xs.data(), reference.data(), xs.size());
+
+		const double ns_double = measure_batch_kernel(get_batch_kernel(supported, accuracy::fast), *program, xs, ys);
+		std::cout << std::format("{:<40} {:>10.2f}", expr, ns_double);
+		for (auto&& [name, level] : levels)
+		{
+			if (level > supported)
+				std::cout << std::format(" {:>10}", "n/a");
+			else
+				std::cout << std::format(" {:>10.2f}", measure_batch_kernel(get_float_batch_kernel(level), *program, xs_float, ys_float));
+		}
+
+		size_t sign_diff = 0;
+		for (size_t i = 0; i < xs.size(); ++i)
+			sign_diff += sign(ys_float[i]) != sign(reference[i]) && !std::isnan(reference[i]);
+		std::cout << std::format(" {:>10}\n", sign_diff);
+	}
+}
+
+void run_benchmarks()
+{
+	static const std::string_view corpus[] = {
+		"x^3-2*x-5",
+		"sin(x)-0.5*x",
+		"x^7-3*x^5+x^3-1",
+		"sin(x)^2+sin(x)*cos(x)+exp(-x)*sin(x)",
+		"2*3.14159/180*x-ln(x+3)",
+		"sqrt(abs(x))*cbrt(x)-ctg(x+2)",
+		"-(-(x^1*1))/1-0",
+	};
+
+	std::cout << std::format("{:<40} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10} {:>10}\n", "formula, ns/call", "reparse", "tree", "bytecode", "registers", "native", "tiered", "batch", "dispatch", "folded", "tree/dag");
+	for (auto&& expr : corpus)
+	{
+		const std::string str(expr);
+
+		parse_context cntxt(str);
+		expression root;
+		parse_expression(cntxt, root);
+		const size_t folded = simplify_and_count(root);
+		const expression_dag dag = build_dag(*root);
+		const auto code = compile_bytecode(dag);
+		const auto program = compile_registers(dag);
+
+		size_t stack_dispatch = 0;
+		for (size_t i = 0; i < code.size(); ++i)
+		{
+			++stack_dispatch;
+			i += code[i].op == opcode::push_const || code[i].op == opcode::load || code[i].op == opcode::store;
+		}
+		const std::string nodes = std::format("{}/{}", count_nodes(*root), dag.nodes.size());
+
+		const double reparse = measure_ns_per_call([&](double x) { return formula(str)(x); }, 100'000);
+		const double tree = measure_ns_per_call([&](double x) { return evaluate(*root, x); }, 10'000'000);
+		const double bytecode = measure_ns_per_call([&](double x) { return run_bytecode(code.data(), x); }, 10'000'000);
+
+		const double registers = measure_ns_per_call([&](double x) { return run_registers(*program, x); }, 10'000'000);
+		const std::string dispatch = std::format("{}/{}", stack_dispatch, program->code.size());
+
+		const native_code native = compile_native(*program);
+		std::string native_result = "n/a";
+		if (native)
+		{
+			const native_function entry = native.entry();
+			native_result = std::format("{:.2f}", measure_ns_per_call(entry, 10'000'000));
+
+			for (int i = -10000; i <= 10000; ++i)
+			{
+				const double x = i / 1000.0;
+				if (std::bit_cast<uint64_t>(entry(x)) != std::bit_cast<uint64_t>(run_registers(*program, x)))
+				{
+					native_result = "mismatch";
+					break;
+				}
+			}
+		}
+
+		const formula f(str);
+		const double tiered = measure_ns_per_call(f, 10'000'000);
+		const double batch = measure_ns_per_element(f, 10'000'000);
+
+		std::cout << std::format("{:<40} {:>10.2f} {:>10.2f} {:>10.2f} {:>10.2f} {:>10} {:>10.2f} {:>10.2f} {:>10} {:>10} {:>10}\n", expr, reparse, tree, bytecode, registers, native_result, tiered, batch, dispatch, folded, nodes);
+	}
+
+	run_power_chain_benchmark();
+	run_simd_benchmark();
+	run_accuracy_benchmark();
+	run_float_benchmark();
+	run_scalar_type_benchmark();
+	run_static_formula_benchmark();
+	run_ahead_of_time_benchmark();
+	run_householder_benchmark();
+	run_bracketing_benchmark();
+	run_finite_difference_benchmark();
+}
+
+
+#include <random>
+
+struct vector_math_function
+{
+	std::string_view name;
+	unary_function reference;
+	double dense_min, dense_max;
+	uint64_t faithful_max_ulp;
+	double fast_max_error;
+};
+
+//The documented error against libm: in ulp for accuracy::faithful, as
+//relative error for accuracy::fast. The fast bounds are the tier's 1e-7. The
+//faithful ones are the worst case on run_math_check's fixed inputs plus two
+//ulp, which is what a fresh random sample each run is held to as well.
+static const vector_math_function vector_math_functions[] = {
+	{ "sin", &sin, -10, 10, 4, 1e-7 },
+	{ "cos", &cos, -10, 10, 4, 1e-7 },
+	{ "tan", &tan, -10, 10, 5, 1e-7 },
+	{ "ctg", &fn_ctg, -10, 10, 6, 1e-7 },
+	{ "exp", &exp, -745, 710, 3, 1e-7 },
+	{ "ln", &log, 0, 4, 3, 1e-7 },
+	{ "lg", &log10, 0, 4, 4, 1e-7 },
+	{ "log2", &log2, 0, 4, 3, 1e-7 },
+	{ "sqrt", &sqrt, 0, 4, 0, 0 },
+	{ "cbrt", &cbrt, -8, 8, 5, 1e-7 },
+};
+
+//Symbolic derivatives against central differences with a step scaled to the
+//argument, and against dual numbers, over every operator and function. The
+//grid stays clear of the jumps of % and // and the kink of abs.
+bool run_derivative_check()
+{
+	static const std::string_view corpus[] = {
+		"x^3-2*x-5",
+		"sin(x)^2+exp(-x)*cos(x)-tan(x)*ctg(x+0.1)",
+		"sqrt(x)*cbrt(x)+ln(x)+lg(x)+log2(x)",
+		"abs(x-1)+sqr(x)/x-(-x)^3",
+		"x^x+2^x+x^2.5+x^(-3)",
+		"x%0.3+x//0.3+2%x+x%x^2",
+	};
+	constexpr double fd_bound = 1e-6, dual_bound = 1e-13, complex_step_bound = 1e-13;
+
+	bool ok = true;
+	std::cout << std::format("{:<40} {:>10} {:>10} {:>10}\n", "derivative", "vs fd", "vs dual", "vs cstep");
+	for (auto&& expr : corpus)
+	{
+		const formula f(std::string(expr), 0);
+		const formula df = f.derivative(0);
+
+		double fd_error = 0, dual_error = 0, complex_step_error = 0;
+		for (int i = 0; i < 100; ++i)
+		{
+			const double x = 0.21 + 0.0123 * i;
+			const double y = df(x);
+			const double fd = estimate_derivative(f, x, 1, false).value;
+			const double ad = f.eval(dual<double>(x, 1)).derivative;
+			const double cs = complex_step_derivative(f, x);
+			fd_error = std::max(fd_error, fabs(y - fd) / std::max(1.0, fabs(fd)));
+			dual_error = std::max(dual_error, fabs(y - ad) / std::max(1.0, fabs(ad)));
+			complex_step_error = std::max(complex_step_error, fabs(y - cs) / std::max(1.0, fabs(cs)));
+		}
+		ok &= fd_error <= fd_bound && dual_error <= dual_bound && complex_step_error <= complex_step_bound;
+		std::cout << std::format("{:<40} {:>10.2e} {:>10.2e} {:>10.2e}\n", expr, fd_error, dual_error, complex_step_error);
+	}
+	std::cout << "\n";
+	return ok;
+}
+
+//Compares the approximate tiers, generic and every SIMD batch kernel, with libm
+//over a dense grid, random arguments up to simd_trig_limit, random bit
+//patterns and hand-picked edge cases, all fixed, and over a fresh sample of
+//the reduction edges drawn with a new seed each run. Returns nonzero if any
+//function exceeds its documented error.
+int run_math_check()
+{
+	std::vector<double> adversarial = {
+		0.0, -0.0, DBL_TRUE_MIN, -DBL_TRUE_MIN, DBL_MIN, -DBL_MIN, DBL_MAX, -DBL_MAX,
+		INFINITY, -INFINITY, NAN, 1, -1, nextafter(1.0, 0.0), nextafter(1.0, 2.0),
+		709.782712893384, 709.7827128933841, -708.3964185322641, -745.1332191019411, -745.1332191019412,
+		simd_trig_limit, nextafter(simd_trig_limit, INFINITY), -simd_trig_limit, 1e22, 6381956970095103.0 * 0x1p797,
+	};
+	for (int e = -1074; e <= 1023; ++e)
+	{
+		adversarial.push_back(ldexp(1.0, e));
+		adversarial.push_back(-ldexp(1.5, e));
+	}
+	for (int k = 1; k <= 10000; ++k)
+	{
+		//Closest doubles to multiples of pi/2, where the reduction cancels
+		const double x = k * 1.57079632679489661923;
+		adversarial.insert(adversarial.end(), { x, nextafter(x, 0.0), nextafter(x, INFINITY), -x });
+	}
+
+	std::mt19937_64 rng(20240229);
+	std::uniform_real_distribution<double> wide(-simd_trig_limit, simd_trig_limit);
+	std::vector<double> random(1 << 17);
+	for (size_t i = 0; i < random.size(); ++i)
+		random[i] = i < random.size() / 2 ? wide(rng) : std::bit_cast<double>(rng());
+
+	//A few ulp either side of multiples of pi/2 up to simd_trig_limit, of 2^20,
+	//of the ends of exp's range and of points within 1/64 of 1, and subnormals
+	const uint64_t seed = std::random_device()();
+	std::cout << std::format("fresh inputs seeded with {}\n\n", seed);
+	std::mt19937_64 fresh_rng(seed);
+	std::uniform_int_distribution<int> ulps(-16, 16);
+	std::uniform_int_distribution<uint64_t> quadrants(1, uint64_t(simd_trig_limit / 1.57079632679489661923));
+	std::uniform_int_distribution<uint64_t> subnormals(16, (uint64_t(1) << 52) - 17);
+	auto nudge = [&](double x)
+	{
+		const uint64_t bits = std::bit_cast<uint64_t>(x) + ulps(fresh_rng);
+		return fresh_rng() & 1 ? -std::bit_cast<double>(bits) : std::bit_cast<double>(bits);
+	};
+	const double edges[] = { 0x1p20, 1, 709.782712893384, -745.1332191019411, -708.3964185322641 };
+	std::vector<double> fresh(1 << 18);
+	for (size_t i = 0; i < fresh.size(); ++i)
+	{
+		switch (i % 4)
+		{
+		case 0: fresh[i] = nudge(double(quadrants(fresh_rng)) * 1.57079632679489661923); break;
+		case 1: fresh[i] = nudge(edges[fresh_rng() % std::size(edges)]); break;
+		case 2: fresh[i] = nudge(std::bit_cast<double>(subnormals(fresh_rng))); break;
+		default: fresh[i] = nudge(1 + std::ldexp(double(ulps(fresh_rng)), -10)); break;
+		}
+	}
+
+	const std::pair<const char*, simd_level> levels[] = {
+		{ "sse2", simd_level::sse2 },
+		{ "avx2", simd_level::avx2 },
+		{ "avx512", simd_level::avx512 },
+	};
+	const simd_level supported = detect_simd_level();
+
+	bool ok = true;
+	for (accuracy policy : { accuracy::faithful, accuracy::fast })
+	{
+		const bool faithful = policy == accuracy::faithful;
+		auto format_error = [&](double error) { return faithful ? std::format("{}", error) : std::format("{:.2e}", error); };
+
+		std::cout << std::format("{:<6} {:>10} {:>10}", faithful ? "ulp" : "error", "bound", "generic");
+		for (auto&& [name, level] : levels)
+			std::cout << std::format(" {:>10}", name);
+		std::cout << "  worst input\n";
+
+		for (auto&& function : vector_math_functions)
+		{
+			std::vector<double> xs(1 << 16);
+			for (size_t i = 0; i < xs.size(); ++i)
+				xs[i] = function.dense_min + (function.dense_max - function.dense_min) * double(i) / (xs.size() - 1);
+			xs.insert(xs.end(), random.begin(), random.end());
+			xs.insert(xs.end(), adversarial.begin(), adversarial.end());
+			xs.insert(xs.end(), fresh.begin(), fresh.end());
+			std::uniform_real_distribution<double> dense(function.dense_min, function.dense_max);
+			for (int i = 0; i < 1 << 18; ++i)
+				xs.push_back(dense(fresh_rng));
+
+			const std::string str = std::format("{}(x)", function.name);
+			parse_context cntxt(str);
+			expression root;
+			parse_expression(cntxt, root);
+			const auto program = compile_registers(build_dag(*root));
+
+			const double bound = faithful ? double(function.faithful_max_ulp) : function.fast_max_error;
+			double worst_x = 0, worst_error = 0;
+			auto measure = [&](const std::vector<double>& ys)
+			{
+				double max_error = 0;
+				for (size_t i = 0; i < xs.size(); ++i)
+				{
+					const double reference = function.reference(xs[i]);
+					const double error = faithful ? double(ulp_distance(ys[i], reference)) : relative_error(ys[i], reference);
+					max_error = std::max(max_error, error);
+					if (error > worst_error)
+					{
+						worst_error = error;
+						worst_x = xs[i];
+					}
+				}
+				ok &= max_error <= bound;
+				return max_error;
+			};
+
+			std::cout << std::format("{:<6} {:>10}", function.name, format_error(bound));
+			std::vector<double> ys(xs.size());
+			get_batch_kernel(simd_level::none, policy)(*program, xs.data(), ys.data(), xs.size());
+			std::cout << std::format(" {:>10}", format_error(measure(ys)));
+
+			for (auto&& [name, level] : levels)
+			{
+				if (level > supported)
+				{
+					std::cout << std::format(" {:>10}", "n/a");
+					continue;
+				}
+				get_batch_kernel(level, policy)(*program, xs.data(), ys.data(), xs.size());
+				std::cout << std::format(" {:>10}", format_error(measure(ys)));
+			}
+			std::cout << std::format("  {}\n", worst_error ? std::format("{:a}", worst_x) : "-");
+		}
+		std::cout << "\n";
+	}
+
+	ok &= run_derivative_check();
+
+	std::cout << (ok ? "all kernels and derivatives within bounds\n" : "some kernels or derivatives exceed their bounds\n");
+	return ok ? 0 : 1;
 }
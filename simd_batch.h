@@ -0,0 +1,127 @@
+//Included by main.cpp at namespace scope for SSE2, and again inside the
+//target region and namespace of each AVX instruction set, so it has no
+//include guard.
+
+//Same register program semantics as run_registers_batch<A>. With
+//accuracy::exact every lane is bit-identical to the scalar interpreter.
+template<class V, accuracy A>
+void run_simd_batch(const register_program& program, const typename V::scalar* xs, typename V::scalar* out, size_t n)
+{
+	using T = typename V::scalar;
+	using WV = typename V::wide;
+	constexpr size_t B = batch_block_size<T>;
+	constexpr size_t W = V::width;
+	constexpr bool vector_math = A != accuracy::exact;
+	static_assert(B % W == 0);
+	T r[register_file_size][B];
+
+	for (size_t i = 0; i < program.constants.size(); ++i)
+		std::fill_n(r[1 + i], B, T(program.constants[i]));
+
+	auto lanes = [&](auto&& kernel)
+	{
+		for (size_t i = 0; i < B; i += W)
+			kernel(i);
+	};
+	auto wide_lanes = [&](T* d, auto&& function, auto... sources)
+	{
+		if constexpr (std::is_same_v<V, WV>)
+			lanes([&](size_t i) { V::store(d + i, function(V::load(sources + i)...)); });
+		else
+			lanes([&](size_t i)
+			{
+				const auto low = function(V::widen_low(V::load(sources + i))...);
+				const auto high = function(V::widen_high(V::load(sources + i))...);
+				V::store(d + i, V::narrow(low, high));
+			});
+	};
+
+	for (size_t base = 0; base < n; base += B)
+	{
+		const size_t count = std::min(B, n - base);
+		std::copy_n(xs + base, count, r[0]);
+		std::fill(r[0] + count, r[0] + B, T(0));
+
+		for (const register_instruction* pc = program.code.data(); ; ++pc)
+		{
+			T* d = r[pc->dst];
+			const T* a = r[pc->a];
+			const T* b = r[pc->b];
+			const T* c = r[pc->c];
+
+			switch (pc->op)
+			{
+			case opcode::negate: lanes([&](size_t i) { V::store(d + i, V::neg(V::load(a + i))); }); continue;
+
+			case opcode::plus: lanes([&](size_t i) { V::store(d + i, V::add(V::load(a + i), V::load(b + i))); }); continue;
+			case opcode::minus: lanes([&](size_t i) { V::store(d + i, V::sub(V::load(a + i), V::load(b + i))); }); continue;
+			case opcode::multiply: lanes([&](size_t i) { V::store(d + i, V::mul(V::load(a + i), V::load(b + i))); }); continue;
+			case opcode::divide: lanes([&](size_t i) { V::store(d + i, V::div(V::load(a + i), V::load(b + i))); }); continue;
+			case opcode::divide_integer:
+				if constexpr (WV::has_trunc)
+					wide_lanes(d, [](auto x, auto y) { return WV::trunc(WV::mul(WV::div(x, y), WV::set1(1 + 2 * DBL_EPSILON))); }, a, b);
+				else
+					for (size_t i = 0; i < B; ++i) d[i] = op_divide_integer(a[i], b[i]);
+				continue;
+			case opcode::remainder: for (size_t i = 0; i < B; ++i) d[i] = fmod(a[i], b[i]); continue;
+			case opcode::power: for (size_t i = 0; i < B; ++i) d[i] = pow(a[i], b[i]); continue;
+
+			case opcode::sin:
+				if (vector_math && simd_trig_in_range(a)) wide_lanes(d, [](auto v) { return simd_sin<WV, A>(v); }, a);
+				else for (size_t i = 0; i < B; ++i) d[i] = sin(a[i]);
+				continue;
+			case opcode::cos:
+				if (vector_math && simd_trig_in_range(a)) wide_lanes(d, [](auto v) { return simd_cos<WV, A>(v); }, a);
+				else for (size_t i = 0; i < B; ++i) d[i] = cos(a[i]);
+				continue;
+			case opcode::tan:
+				if (vector_math && simd_trig_in_range(a)) wide_lanes(d, [](auto v) { return simd_tan<WV, A>(v, false); }, a);
+				else for (size_t i = 0; i < B; ++i) d[i] = tan(a[i]);
+				continue;
+			case opcode::ctg:
+				if (vector_math && simd_trig_in_range(a)) wide_lanes(d, [](auto v) { return simd_tan<WV, A>(v, true); }, a);
+				else for (size_t i = 0; i < B; ++i) d[i] = fn_ctg(a[i]);
+				continue;
+			case opcode::sqrt: lanes([&](size_t i) { V::store(d + i, V::sqrt(V::load(a + i))); }); continue;
+			case opcode::cbrt:
+				if (vector_math) wide_lanes(d, [](auto v) { return simd_cbrt<WV, A>(v); }, a);
+				else for (size_t i = 0; i < B; ++i) d[i] = cbrt(a[i]);
+				continue;
+			case opcode::sqr: lanes([&](size_t i) { const auto v = V::load(a + i); V::store(d + i, V::mul(v, v)); }); continue;
+			case opcode::abs: lanes([&](size_t i) { V::store(d + i, V::abs(V::load(a + i))); }); continue;
+			case opcode::exp:
+				if (vector_math) wide_lanes(d, [](auto v) { return simd_exp<WV, A>(v); }, a);
+				else for (size_t i = 0; i < B; ++i) d[i] = exp(a[i]);
+				continue;
+			case opcode::ln:
+				if (vector_math) wide_lanes(d, [](auto v) { return simd_log<WV, A>(v); }, a);
+				else for (size_t i = 0; i < B; ++i) d[i] = log(a[i]);
+				continue;
+			case opcode::lg:
+				if (vector_math) wide_lanes(d, [](auto v) { return simd_log10<WV, A>(v); }, a);
+				else for (size_t i = 0; i < B; ++i) d[i] = log10(a[i]);
+				continue;
+			case opcode::log2:
+				if (vector_math) wide_lanes(d, [](auto v) { return simd_log2<WV, A>(v); }, a);
+				else for (size_t i = 0; i < B; ++i) d[i] = log2(a[i]);
+				continue;
+
+			case opcode::mul_add: lanes([&](size_t i) { V::store(d + i, V::add(V::mul(V::load(a + i), V::load(b + i)), V::load(c + i))); }); continue;
+			case opcode::mul_sub: lanes([&](size_t i) { V::store(d + i, V::sub(V::mul(V::load(a + i), V::load(b + i)), V::load(c + i))); }); continue;
+			case opcode::neg_mul_add: lanes([&](size_t i) { V::store(d + i, V::sub(V::load(c + i), V::mul(V::load(a + i), V::load(b + i)))); }); continue;
+
+			case opcode::ret:
+				std::copy_n(a, count, out + base);
+				break;
+
+			case opcode::push_const:
+			case opcode::push_x:
+			case opcode::load:
+			case opcode::store:
+				std::fill_n(out + base, count, T(NAN));
+				break;
+			}
+			break;
+		}
+	}
+}
@@ -0,0 +1,277 @@
+//Included by main.cpp at namespace scope for the scalar tiers and SSE2, and
+//again inside the target region and namespace of each AVX instruction set,
+//so it has no include guard.
+
+//Vectorized versions of the transcendental functions in the function table:
+//range reduction plus a polynomial, written once over a vector type V
+//(simd_scalar, or the SSE2/AVX2/AVX-512 wrappers). accuracy::faithful
+//stays within a few ulp of libm, accuracy::fast uses shorter polynomials;
+//the documented bounds that --check-math holds them to are in
+//vector_math_functions.
+
+template<class V, class... C>
+typename V::reg simd_horner(typename V::reg x, double c0, C... c)
+{
+	if constexpr (sizeof...(C) == 0)
+		return V::set1(c0);
+	else
+		return V::add(V::mul(simd_horner<V>(x, c...), x), V::set1(c0));
+}
+
+//Round to nearest for |x| < 2^51. The integer is also left in the low bits
+//of q, which the trigonometric functions use to pick the quadrant.
+template<class V>
+typename V::reg simd_round(typename V::reg x, typename V::ireg& q)
+{
+	const auto shifter = V::set1(0x1.8p52);
+	const auto t = V::add(x, shifter);
+	q = V::bits(t);
+	return V::sub(t, shifter);
+}
+template<class V>
+typename V::reg simd_round(typename V::reg x)
+{
+	typename V::ireg q;
+	return simd_round<V>(x, q);
+}
+
+//2^k for integral k in [-1022, 1023]
+template<class V>
+typename V::reg simd_exp2i(typename V::reg k)
+{
+	const auto biased = V::add(k, V::set1(0x1p52 + 1023));
+	return V::from_bits(V::shl(V::bits(biased), 52));
+}
+
+//x = m * 2^e with 1 <= m < 2 for positive finite x, subnormals included
+template<class V>
+typename V::reg simd_split_exponent(typename V::reg x, typename V::reg& e)
+{
+	const auto tiny = V::lt(x, V::set1(DBL_MIN));
+	x = V::select(tiny, V::mul(x, V::set1(0x1p54)), x);
+
+	const auto b = V::bits(x);
+	const auto two52 = V::set1(0x1p52);
+	const auto biased = V::sub(V::from_bits(V::ior(V::shr(b, 52), V::bits(two52))), two52);
+	e = V::sub(biased, V::select(tiny, V::set1(1023 + 54), V::set1(1023)));
+	return V::from_bits(V::ior(V::iand(b, V::iset1(0x000FFFFFFFFFFFFF)), V::bits(V::set1(1.0))));
+}
+
+template<class V, accuracy A>
+typename V::reg simd_exp(typename V::reg x)
+{
+	//exp(x) = 2^k * exp(r) with |r| <= ln(2)/2; k*ln2_hi is exact.
+	constexpr double ln2_hi = 6.93147180369123816490e-01;
+	constexpr double ln2_lo = 1.90821492927058770002e-10;
+
+	x = V::min(V::set1(710), V::max(V::set1(-746), x));
+	const auto k = simd_round<V>(V::mul(x, V::set1(1.44269504088896338700e+00)));
+	const auto r = V::sub(V::sub(x, V::mul(k, V::set1(ln2_hi))), V::mul(k, V::set1(ln2_lo)));
+
+	typename V::reg p;
+	if constexpr (A == accuracy::fast)
+		p = simd_horner<V>(r, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040);
+	else
+		p = simd_horner<V>(r, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040, 1.0 / 40320,
+			1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600, 1.0 / 6227020800);
+	const auto y = V::add(V::set1(1), V::add(r, V::mul(V::mul(r, r), p)));
+
+	//Two scalings keep both powers of two normal; subnormal results round once.
+	const auto k1 = simd_round<V>(V::mul(k, V::set1(0.5)));
+	return V::mul(V::mul(y, simd_exp2i<V>(k1)), simd_exp2i<V>(V::sub(k, k1)));
+}
+
+//x = 2^k * (1 + f) with sqrt(2)/2 <= 1 + f < sqrt(2), and
+//log(1 + f) = f - hfsq + r as in fdlibm's __ieee754_log.
+template<class V, accuracy A>
+void simd_log_reduce(typename V::reg x, typename V::reg& k, typename V::reg& f, typename V::reg& hfsq, typename V::reg& r)
+{
+	auto m = simd_split_exponent<V>(x, k);
+	const auto big = V::lt(V::set1(1.41421356237309504880), m);
+	m = V::select(big, V::mul(m, V::set1(0.5)), m);
+	k = V::select(big, V::add(k, V::set1(1)), k);
+
+	f = V::sub(m, V::set1(1));
+	hfsq = V::mul(V::set1(0.5), V::mul(f, f));
+	const auto s = V::div(f, V::add(V::set1(2), f));
+	const auto z = V::mul(s, s);
+	typename V::reg R;
+	if constexpr (A == accuracy::fast)
+		R = V::mul(z, simd_horner<V>(z, 2.0 / 3, 2.0 / 5, 2.0 / 7));
+	else
+	{
+		const auto w = V::mul(z, z);
+		const auto t1 = V::mul(w, simd_horner<V>(w, 3.999999999940941908e-01, 2.222219843214978396e-01, 1.531383769920937332e-01));
+		const auto t2 = V::mul(z, simd_horner<V>(w, 6.666666666666735130e-01, 2.857142874366239149e-01, 1.818357216161805012e-01, 1.479819860511658591e-01));
+		R = V::add(t2, t1);
+	}
+	r = V::mul(s, V::add(hfsq, R));
+}
+template<class V>
+typename V::reg simd_log_specials(typename V::reg x, typename V::reg y)
+{
+	y = V::select(V::eq(x, V::set1(0)), V::set1(-INFINITY), y);
+	y = V::select(V::lt(x, V::set1(0)), V::set1(NAN), y);
+	return V::select(V::mask_or(V::is_nan(x), V::eq(x, V::set1(INFINITY))), x, y);
+}
+//hi + lo = log(1 + f), hi having only 21 significant bits
+template<class V>
+void simd_log_split(typename V::reg f, typename V::reg hfsq, typename V::reg r, typename V::reg& hi, typename V::reg& lo)
+{
+	hi = V::sub(f, hfsq);
+	hi = V::from_bits(V::iand(V::bits(hi), V::iset1(~int64_t(0xFFFFFFFF))));
+	lo = V::add(V::sub(V::sub(f, hi), hfsq), r);
+}
+
+template<class V, accuracy A>
+typename V::reg simd_log(typename V::reg x)
+{
+	constexpr double ln2_hi = 6.93147180369123816490e-01;
+	constexpr double ln2_lo = 1.90821492927058770002e-10;
+
+	typename V::reg k, f, hfsq, r;
+	simd_log_reduce<V, A>(x, k, f, hfsq, r);
+	const auto y = V::sub(V::mul(k, V::set1(ln2_hi)), V::sub(V::sub(hfsq, V::add(r, V::mul(k, V::set1(ln2_lo)))), f));
+	return simd_log_specials<V>(x, y);
+}
+template<class V, accuracy A>
+typename V::reg simd_log2(typename V::reg x)
+{
+	constexpr double ivln2_hi = 1.44269504072144627571e+00;
+	constexpr double ivln2_lo = 1.67517131648865118353e-10;
+
+	typename V::reg k, f, hfsq, r, hi, lo;
+	simd_log_reduce<V, A>(x, k, f, hfsq, r);
+	simd_log_split<V>(f, hfsq, r, hi, lo);
+
+	const auto val_hi = V::mul(hi, V::set1(ivln2_hi));
+	auto val_lo = V::add(V::mul(V::add(lo, hi), V::set1(ivln2_lo)), V::mul(lo, V::set1(ivln2_hi)));
+	const auto w = V::add(k, val_hi);
+	val_lo = V::add(val_lo, V::add(V::sub(k, w), val_hi));
+	return simd_log_specials<V>(x, V::add(val_lo, w));
+}
+template<class V, accuracy A>
+typename V::reg simd_log10(typename V::reg x)
+{
+	constexpr double ivln10_hi = 4.34294481878168880939e-01;
+	constexpr double ivln10_lo = 2.50829467116452752298e-11;
+	constexpr double log10_2_hi = 3.01029995663611771306e-01;
+	constexpr double log10_2_lo = 3.69423907715893078616e-13;
+
+	typename V::reg k, f, hfsq, r, hi, lo;
+	simd_log_reduce<V, A>(x, k, f, hfsq, r);
+	simd_log_split<V>(f, hfsq, r, hi, lo);
+
+	const auto val_hi = V::mul(hi, V::set1(ivln10_hi));
+	const auto y2 = V::mul(k, V::set1(log10_2_hi));
+	auto val_lo = V::add(V::add(V::mul(k, V::set1(log10_2_lo)), V::mul(V::add(lo, hi), V::set1(ivln10_lo))), V::mul(lo, V::set1(ivln10_hi)));
+	const auto w = V::add(y2, val_hi);
+	val_lo = V::add(val_lo, V::add(V::sub(y2, w), val_hi));
+	return simd_log_specials<V>(x, V::add(val_lo, w));
+}
+
+//Beyond this the reduction below loses bits; such arguments go to libm.
+constexpr double simd_trig_limit = 0x1p20;
+
+//x = k*pi/2 + r with |r| <= pi/4. pi/2 is split into 33-bit parts so that
+//k*part is exact below simd_trig_limit, plus a rounded fourth part.
+//s and c are sin(r) and cos(r) (fdlibm's kernels), q holds k in its low bits.
+template<class V, accuracy A>
+void simd_trig_reduce(typename V::reg x, typename V::reg& s, typename V::reg& c, typename V::ireg& q)
+{
+	const auto k = simd_round<V>(V::mul(x, V::set1(6.36619772367581382433e-01)), q);
+	auto r = V::sub(x, V::mul(k, V::set1(1.57079632673412561417e+00)));
+	r = V::sub(r, V::mul(k, V::set1(6.07710050630396597660e-11)));
+	r = V::sub(r, V::mul(k, V::set1(2.02226624871116645580e-21)));
+	r = V::sub(r, V::mul(k, V::set1(8.47842766036889956997e-32)));
+
+	const auto z = V::mul(r, r);
+	typename V::reg sin_tail, cos_tail;
+	if constexpr (A == accuracy::fast)
+	{
+		sin_tail = simd_horner<V>(z, -1.0 / 6, 1.0 / 120, -1.0 / 5040, 1.0 / 362880);
+		cos_tail = simd_horner<V>(z, 1.0 / 24, -1.0 / 720, 1.0 / 40320);
+	}
+	else
+	{
+		sin_tail = simd_horner<V>(z, -1.66666666666666324348e-01, 8.33333333332248946124e-03, -1.98412698298579493134e-04,
+			2.75573137070700676789e-06, -2.50507602534068634195e-08, 1.58969099521155010221e-10);
+		cos_tail = simd_horner<V>(z, 4.16666666666666019037e-02, -1.38888888888741095749e-03, 2.48015872894767294178e-05,
+			-2.75573143513906633035e-07, 2.08757232129817482790e-09, -1.13596475577881948265e-11);
+	}
+
+	s = V::add(r, V::mul(V::mul(z, r), sin_tail));
+	//Keeps the sign of a zero argument
+	s = V::select(V::lt(V::abs(r), V::set1(0x1p-27)), r, s);
+
+	const auto hz = V::mul(V::set1(0.5), z);
+	const auto w = V::sub(V::set1(1), hz);
+	c = V::add(w, V::add(V::sub(V::sub(V::set1(1), w), hz), V::mul(V::mul(z, z), cos_tail)));
+}
+template<class V>
+typename V::mask simd_is_odd(typename V::ireg q)
+{
+	const auto two52 = V::set1(0x1p52);
+	return V::eq(V::from_bits(V::ior(V::iand(q, V::iset1(1)), V::bits(two52))), V::add(two52, V::set1(1)));
+}
+
+//cos(x) = sin(x + pi/2), so cos is sin one quadrant further
+template<class V, accuracy A>
+typename V::reg simd_sin_quadrant(typename V::reg x, int64_t quadrant)
+{
+	typename V::reg s, c;
+	typename V::ireg q;
+	simd_trig_reduce<V, A>(x, s, c, q);
+	q = V::iadd(q, V::iset1(quadrant));
+
+	const auto y = V::select(simd_is_odd<V>(q), c, s);
+	return V::from_bits(V::ixor(V::bits(y), V::shl(V::iand(q, V::iset1(2)), 62)));
+}
+template<class V, accuracy A>
+typename V::reg simd_sin(typename V::reg x)
+{
+	return simd_sin_quadrant<V, A>(x, 0);
+}
+template<class V, accuracy A>
+typename V::reg simd_cos(typename V::reg x)
+{
+	return simd_sin_quadrant<V, A>(x, 1);
+}
+template<class V, accuracy A>
+typename V::reg simd_tan(typename V::reg x, bool reciprocal)
+{
+	typename V::reg s, c;
+	typename V::ireg q;
+	simd_trig_reduce<V, A>(x, s, c, q);
+
+	//tan(r + pi/2) = -cos(r)/sin(r)
+	const auto odd = simd_is_odd<V>(q);
+	const auto num = V::select(odd, V::neg(c), s);
+	const auto den = V::select(odd, s, c);
+	return reciprocal ? V::div(den, num) : V::div(num, den);
+}
+
+template<class V, accuracy A>
+typename V::reg simd_cbrt(typename V::reg x)
+{
+	//|x| = 2^(3j) * y with 1/2 <= y < 4. A quadratic guess within 4% is
+	//refined by Halley steps and a final Newton step.
+	const auto ax = V::abs(x);
+	typename V::reg e;
+	const auto m = simd_split_exponent<V>(ax, e);
+	const auto j = simd_round<V>(V::mul(e, V::set1(1.0 / 3)));
+	const auto y = V::mul(m, simd_exp2i<V>(V::sub(e, V::mul(j, V::set1(3)))));
+
+	auto t = simd_horner<V>(y, 0.636237, 0.393390, -0.0404127);
+	for (int i = 0; i < (A == accuracy::fast ? 1 : 2); ++i)
+	{
+		const auto t3 = V::mul(V::mul(t, t), t);
+		t = V::mul(t, V::div(V::add(t3, V::add(y, y)), V::add(V::add(t3, t3), y)));
+	}
+	t = V::add(t, V::mul(V::sub(V::div(y, V::mul(t, t)), t), V::set1(1.0 / 3)));
+
+	auto result = V::mul(t, simd_exp2i<V>(j));
+	result = V::from_bits(V::ior(V::bits(result), V::iand(V::bits(x), V::iset1(INT64_MIN))));
+	const auto special = V::mask_or(V::mask_or(V::eq(ax, V::set1(0)), V::eq(ax, V::set1(INFINITY))), V::is_nan(x));
+	return V::select(special, x, result);
+}